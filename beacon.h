@@ -0,0 +1,54 @@
+/*
+ * Event beacon on IO_D0.
+ *
+ * For the length of mapping or a run, IO_D0 is driven low.  Each event
+ * below is sent as that many 0.25 us high pulses, 0.25 us apart, with
+ * interrupts held off so a timer can't split the burst, then a 2 us
+ * gap so the next burst can't run into it.  A logic analyser on the pin
+ * timestamps every event to well under a microsecond, and
+ * tools/beacondecode turns a capture into latency tables.
+ *
+ * IO_D0 is also the USART's RX pin, which map-link.c listens on between
+ * runs.  An event while the pin isn't driven, such as a turn after a
+ * run has finished, sends nothing, so it can't clear the pull-up or
+ * drive the line under a plan coming in.
+ */
+
+#ifndef __beacon_h
+#define __beacon_h
+
+#include <avr/interrupt.h>
+
+#define BEACON_SEGMENT_START 1
+#define BEACON_INTERSECTION  2 // or a dead end
+#define BEACON_TURN_START    3
+#define BEACON_TURN_END      4
+#define BEACON_RUN_START     5
+#define BEACON_RUN_FINISH    6
+#define BEACON_TICK_OVERRUN  7 // a control tick started late
+
+#define BEACON_PULSE_CYCLES 5 // 0.25 us at 20 MHz
+#define BEACON_GAP_CYCLES  40 // 2 us
+
+#define beacon(event) do { \
+    if (!(DDRD & (1 << PD0))) \
+      break; \
+    uint8_t beacon_sreg = SREG; \
+    cli(); \
+    for (uint8_t beacon_i = (event); beacon_i; beacon_i--) \
+    { \
+      PORTD |= 1 << PD0; \
+      __builtin_avr_delay_cycles(BEACON_PULSE_CYCLES); \
+      PORTD &= ~(1 << PD0); \
+      __builtin_avr_delay_cycles(BEACON_PULSE_CYCLES); \
+    } \
+    SREG = beacon_sreg; \
+    __builtin_avr_delay_cycles(BEACON_GAP_CYCLES); \
+  } while (0)
+
+// The pin is only driven while mapping or running, and floats high with
+// the pull-up the rest of the time.
+#define beacon_run_start() do { set_digital_output(IO_D0, LOW); beacon(BEACON_RUN_START); } while (0)
+#define beacon_run_finish() do { beacon(BEACON_RUN_FINISH); set_digital_input(IO_D0, PULL_UP_ENABLED); } while (0)
+
+#endif
@@ -2,6 +2,7 @@
 
 #include <pololu/3pi.h>
 #include <avr/eeprom.h>
+#include <stdlib.h>
 #include "sounds.h"
 #include "bargraph.h"
 
@@ -9,17 +10,66 @@
 
 unsigned int EEMEM stored_minimum_on[LINE_SENSOR_COUNT];
 unsigned int EEMEM stored_maximum_on[LINE_SENSOR_COUNT];
+unsigned int EEMEM stored_timeout;
+
+// Adaptive calibration.  While following a line, a sensor within
+// ADAPT_ON_LINE of the line position is known to be over the line, and
+// one at least ADAPT_OFF_LINE away is known to be over the floor.  Their
+// readings pull the sensor's maximum or minimum towards what they read,
+// a 1/2^ADAPT_SHIFT of the way and no more than ADAPT_MAX_STEP, once
+// every ADAPT_INTERVAL readings.  A reading that is pinned at 0 or 1000
+// can't say how far out the true value is, so it is taken as
+// ADAPT_PROBE beyond the current limit.
+#define ADAPT_ON_LINE   300
+#define ADAPT_OFF_LINE 1800
+#define ADAPT_INTERVAL   16
+#define ADAPT_SHIFT       4
+#define ADAPT_MAX_STEP    2
+#define ADAPT_PROBE      32
+#define ADAPT_MIN_RANGE 200 // never let a sensor's range shrink below this
+
+// don't bother writing the EEPROM for less than this much drift
+#define SAVE_THRESHOLD   16
+
+// The sensors are read by timing their discharge, in 0.4 us ticks, up
+// to a timeout: 2000 ticks while calibrating, and after that a quarter
+// more than the darkest maximum found by calibrating.  Anything slower
+// is black, and reads as 1000 since no maximum is let go past the
+// timeout.  It is stored on its own rather than worked out from the
+// stored maxima, which adaptation keeps rewriting; otherwise every boot
+// would let them creep up another quarter.
+#define READ_TIMEOUT_MAX     2000
+#define READ_TIMEOUT_MARGIN     4 // timeout / this on top
+
+unsigned int read_timeout = READ_TIMEOUT_MAX;
+
+uint8_t adapt_count;
 
 
 void save_stored_calibration()
 { 
   for (uint8_t i = 0; i < LINE_SENSOR_COUNT; i++)
   {
-    eeprom_write_word(&stored_minimum_on[i], get_line_sensors_calibrated_minimum_on()[i]);
-    eeprom_write_word(&stored_maximum_on[i], get_line_sensors_calibrated_maximum_on()[i]);
+    eeprom_update_word(&stored_minimum_on[i], get_line_sensors_calibrated_minimum_on()[i]);
+    eeprom_update_word(&stored_maximum_on[i], get_line_sensors_calibrated_maximum_on()[i]);
   }
 }
 
+// The timeout for the maxima just found by calibrate_line_sensors().
+unsigned int calibrated_read_timeout()
+{
+  unsigned int *maximum = get_line_sensors_calibrated_maximum_on();
+  unsigned int timeout = 0;
+  
+  for (uint8_t i = 0; i < LINE_SENSOR_COUNT; i++)
+  {
+    if (maximum[i] > timeout)
+      timeout = maximum[i];
+  }
+  timeout += timeout / READ_TIMEOUT_MARGIN;
+  return (timeout > READ_TIMEOUT_MAX) ? READ_TIMEOUT_MAX : timeout;
+}
+
 void perform_calibration()
 {
   unsigned int counter; // used as a simple timer
@@ -60,6 +110,7 @@ void perform_calibration()
   set_motors(0,0);
   
   save_stored_calibration();
+  eeprom_update_word(&stored_timeout, calibrated_read_timeout());
 
   // Display calibrated values as a bar graph.
   while(1)
@@ -81,11 +132,108 @@ void perform_calibration()
   }
 }
 
+// Moves one limit towards a reading of value, which is on the 0 to 1000
+// scale of the current limits.
+int adapt_step(unsigned int value, unsigned int minimum, unsigned int maximum, unsigned int limit)
+{
+  long reading;
+  
+  if (value == 0)
+    reading = (minimum > ADAPT_PROBE) ? (long)minimum - ADAPT_PROBE : 0;
+  else if (value >= 1000)
+    reading = (long)maximum + ADAPT_PROBE;
+  else
+    reading = minimum + (long)value * ((long)maximum - minimum) / 1000;
+    
+  long step = (reading - (long)limit) / (1 << ADAPT_SHIFT);
+  if (step > ADAPT_MAX_STEP)
+    step = ADAPT_MAX_STEP;
+  if (step < -ADAPT_MAX_STEP)
+    step = -ADAPT_MAX_STEP;
+  return step;
+}
+
+void adapt_calibration(const unsigned int *sensors, unsigned int position)
+{
+  if (++adapt_count < ADAPT_INTERVAL)
+    return;
+    
+  // only trust the position while a single line is under the middle
+  // three sensors
+  if (position < 1000 || position > 3000 || sensors[0] > 500 || sensors[4] > 500)
+    return;
+    
+  adapt_count = 0;
+    
+  unsigned int *minimum = get_line_sensors_calibrated_minimum_on();
+  unsigned int *maximum = get_line_sensors_calibrated_maximum_on();
+  
+  for (uint8_t i = 0; i < LINE_SENSOR_COUNT; i++)
+  {
+    int offset = (int)(i * 1000) - (int)position;
+    if (offset < 0)
+      offset = -offset;
+      
+    if (offset <= ADAPT_ON_LINE)
+    {
+      maximum[i] += adapt_step(sensors[i], minimum[i], maximum[i], maximum[i]);
+      if (maximum[i] > read_timeout)
+        maximum[i] = read_timeout; // no reading gets past it
+      if (maximum[i] < minimum[i] + ADAPT_MIN_RANGE)
+        maximum[i] = minimum[i] + ADAPT_MIN_RANGE;
+    }
+    else if (offset >= ADAPT_OFF_LINE)
+    {
+      minimum[i] += adapt_step(sensors[i], minimum[i], maximum[i], minimum[i]);
+      // a stored maximum can be under ADAPT_MIN_RANGE for a sensor
+      // that barely saw the line; don't let the limit wrap below 0
+      if (maximum[i] < minimum[i] + ADAPT_MIN_RANGE)
+        minimum[i] = (maximum[i] > ADAPT_MIN_RANGE) ? maximum[i] - ADAPT_MIN_RANGE : 0;
+    }
+  }
+}
+
+// Writes the adapted calibration back once it has drifted far enough
+// from what's stored.  Only called while stopped, since a write takes a
+// few ms per word.
+void save_adapted_calibration()
+{
+  unsigned int *minimum = get_line_sensors_calibrated_minimum_on();
+  unsigned int *maximum = get_line_sensors_calibrated_maximum_on();
+  
+  for (uint8_t i = 0; i < LINE_SENSOR_COUNT; i++)
+  {
+    if (abs((int)(minimum[i] - eeprom_read_word(&stored_minimum_on[i]))) >= SAVE_THRESHOLD ||
+        abs((int)(maximum[i] - eeprom_read_word(&stored_maximum_on[i]))) >= SAVE_THRESHOLD)
+    {
+      save_stored_calibration();
+      return;
+    }
+  }
+}
+
 bool check_stored_calibration()
 {
   return (eeprom_read_word(&stored_maximum_on[LINE_SENSOR_COUNT - 1]) != 0xFFFF);
 }
 
+unsigned int stored_read_timeout()
+{
+  unsigned int timeout = eeprom_read_word(&stored_timeout);
+  
+  // calibrated before the timeout was stored
+  if (timeout == 0xFFFF)
+    return READ_TIMEOUT_MAX;
+  return timeout;
+}
+
+void init_3pi(bool calibrating)
+{
+  if (!calibrating)
+    read_timeout = stored_read_timeout();
+  pololu_3pi_init(read_timeout);
+}
+
 void load_stored_calibration()
 {
   calibrate_line_sensors(IR_EMITTERS_ON); // allocate stuff
@@ -5,6 +5,21 @@
 
 void perform_calibration();
 bool check_stored_calibration();
+
+// Sets up the 3pi, with the full sensor timeout for calibrating or one
+// that suits the stored calibration.  The 3pi library only takes a
+// timeout here, and setting up again restarts millis(), so this has to
+// be the only call.
+void init_3pi(bool calibrating);
+
 void load_stored_calibration();
 
+// the sensor timeout in 0.4 us ticks
+extern unsigned int read_timeout;
+
+// Tracks slow changes in the floor and the lighting, given each
+// read_line() result while following a line.
+void adapt_calibration(const unsigned int *sensors, unsigned int position);
+void save_adapted_calibration();
+
 #endif
\ No newline at end of file
@@ -0,0 +1,92 @@
+/*
+ * This file keeps a copy of the LCD's text in RAM.
+ *
+ * Writing to the LCD waits on the HD44780 for every character, which
+ * used to happen in the middle of handling an intersection.  Instead,
+ * the display_* calls only change the RAM copy and note which characters
+ * differ from the screen, and display_flush() writes a few of those at a
+ * time from places where a short delay doesn't matter, such as once per
+ * pass of the line following loops.
+ */
+
+#include <pololu/3pi.h>
+#include "display.h"
+
+char display_text[DISPLAY_CHARS]; // row by row
+uint16_t display_dirty;           // a bit per character that needs writing
+uint8_t display_cursor;           // where the next display_print() goes
+uint8_t lcd_cursor = 0xFF;        // where the LCD will put the next character, 0xFF if unknown
+
+void display_put(uint8_t i, char c)
+{
+  if (display_text[i] != c)
+  {
+    display_text[i] = c;
+    display_dirty |= 1U << i;
+  }
+}
+
+void display_clear()
+{
+  for (uint8_t i = 0; i < DISPLAY_CHARS; i++)
+    display_put(i, ' ');
+  display_cursor = 0;
+}
+
+void display_goto(uint8_t x, uint8_t y)
+{
+  display_cursor = y * DISPLAY_WIDTH + x;
+}
+
+// Text past the end of the row is dropped.
+void display_print(const char *str)
+{
+  uint8_t row_end = (display_cursor / DISPLAY_WIDTH + 1) * DISPLAY_WIDTH;
+  
+  for (; *str; str++)
+  {
+    if (display_cursor < row_end)
+      display_put(display_cursor, *str);
+    display_cursor++;
+  }
+}
+
+void display_print_long(long value)
+{
+  char buf[12];
+  uint8_t i = sizeof(buf);
+  unsigned long digits = (value < 0) ? -(unsigned long)value : value;
+  
+  buf[--i] = 0;
+  do
+  {
+    buf[--i] = '0' + digits % 10;
+    digits /= 10;
+  } while (digits);
+  if (value < 0)
+    buf[--i] = '-';
+    
+  display_print(buf + i);
+}
+
+// Writes up to max_chars of the characters that have changed.  Returns
+// true if there are more to write.
+bool display_flush(uint8_t max_chars)
+{
+  while (display_dirty && max_chars--)
+  {
+    uint8_t i = 0;
+    while (!(display_dirty & (1U << i)))
+      i++;
+      
+    if (i != lcd_cursor)
+      lcd_goto_xy(i % DISPLAY_WIDTH, i / DISPLAY_WIDTH);
+    print_character(display_text[i]);
+    display_dirty &= ~(1U << i);
+    
+    // the LCD's address doesn't run on from one row to the next
+    lcd_cursor = ((i + 1) % DISPLAY_WIDTH) ? i + 1 : 0xFF;
+  }
+  
+  return display_dirty != 0;
+}
@@ -0,0 +1,16 @@
+#ifndef __display_h
+#define __display_h
+
+#include <stdbool.h>
+
+#define DISPLAY_WIDTH  8
+#define DISPLAY_HEIGHT 2
+#define DISPLAY_CHARS  (DISPLAY_WIDTH * DISPLAY_HEIGHT)
+
+void display_clear();
+void display_goto(uint8_t x, uint8_t y);
+void display_print(const char *str);
+void display_print_long(long value);
+bool display_flush(uint8_t max_chars);
+
+#endif
@@ -8,16 +8,43 @@
  */
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <pololu/3pi.h>
 #include "sounds.h"
+#include "params.h"
+#include "beacon.h"
+#include "scheduler.h"
+#include "follow-segment.h"
+#include "calibrate.h"
+#include "motors.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+unsigned int last_node_ms;
+bool overshot;
+uint8_t exit_power;
+
+// find_line() turns this long each way at this speed, which is about
+// 30 degrees
+#define LINE_SEARCH_MS    120
+#define LINE_SEARCH_SPEED  60
+
+// how often follow_segment_aggressive() may look for a lost line
+#define LINE_SEARCHES 2
+
+// The fast followers only take the line for gone once sensors 1-3 have
+// all missed it for this many ticks in a row; a wobble coming out of a
+// turn can lose it for a tick or two.
+#define LOST_TICKS 3
+
 void follow_segment()
 {
 	int last_proportional = 0;
 	long integral=0;
 
+	beacon(BEACON_SEGMENT_START);
+
+	start_ticks();
 	while(1)
 	{
     /*if (!is_playing())
@@ -27,9 +54,14 @@ void follow_segment()
 		// similar to the 3pi-linefollower-pid example, but the maximum
 		// speed is turned down to 60 for reliability.
 
+		// Wait for the next control tick, doing background work and
+		// LCD output in the meantime.
+		wait_for_tick();
+
 		// Get the position of the line.
 		unsigned int sensors[5];
 		unsigned int position = read_line(sensors,IR_EMITTERS_ON);
+		adapt_calibration(sensors, position);
 
 		// The "proportional" term should be 0 when we are on the line.
 		int proportional = ((int)position) - 2000;
@@ -47,35 +79,37 @@ void follow_segment()
 		// to the left.  If it is a negative number, the robot will
 		// turn to the right, and the magnitude of the number determines
 		// the sharpness of the turn.
-		int power_difference = proportional/20 + integral/10000 + derivative*3/2;
+		int power_difference = proportional/params[PARAM_P_DIV] + integral/params[PARAM_I_DIV] + derivative*params[PARAM_D_HALVES]/2;
 
 		// Compute the actual motor settings.  We never set either motor
 		// to a negative value.
-		const int power_max = 60; // the maximum speed
+		const int power_max = params[PARAM_SPEED]; // the maximum speed
 		if(power_difference > power_max)
 			power_difference = power_max;
 		if(power_difference < -power_max)
 			power_difference = -power_max;
 		
 		if(power_difference < 0)
-			set_motors(power_max+power_difference,power_max);
+			drive_motors(power_max+power_difference,power_max);
 		else
-			set_motors(power_max,power_max-power_difference);
+			drive_motors(power_max,power_max-power_difference);
 
 		// We use the inner three sensors (1, 2, and 3) for
 		// determining whether there is a line straight ahead, and the
 		// sensors 0 and 4 for detecting lines going to the left and
 		// right.
 
-		if(sensors[1] < 100 && sensors[2] < 100 && sensors[3] < 100)
+		if(sensors[1] < params[PARAM_LOST] && sensors[2] < params[PARAM_LOST] && sensors[3] < params[PARAM_LOST])
 		{
 			// There is no line visible ahead, and we didn't see any
 			// intersection.  Must be a dead end.
+			beacon(BEACON_INTERSECTION);
 			return;
 		}
-		else if(sensors[0] > 200 || sensors[4] > 200)
+		else if(sensors[0] > params[PARAM_LINE] || sensors[4] > params[PARAM_LINE])
 		{
 			// Found an intersection.
+			beacon(BEACON_INTERSECTION);
 			return;
 		}
 
@@ -83,18 +117,163 @@ void follow_segment()
 }
 
 
-void follow_segment_aggressive(int8_t seg_length, uint8_t intersections_to_ignore)
+// Like follow_segment(), but drives straight through the next
+// intersections_to_ignore intersections instead of stopping at them.
+// The robot may start on top of the intersection it just turned at, so
+// that one isn't counted.  Returns the number of intersections seen,
+// which is no more than intersections_to_ignore if it hit a dead end.
+uint8_t follow_segment_continuous(uint8_t intersections_to_ignore)
+{
+	int last_proportional = 0;
+	long integral=0;
+
+	beacon(BEACON_SEGMENT_START);
+
+  uint8_t intersections_seen = 0;
+  bool on_intersection = true;
+  uint8_t lost_ticks = 0;
+
+  last_node_ms = get_ms();
+
+	start_ticks();
+	while(1)
+	{
+		wait_for_tick();
+
+		// Get the position of the line.
+		unsigned int sensors[5];
+		unsigned int position = read_line(sensors,IR_EMITTERS_ON);
+		adapt_calibration(sensors, position);
+
+		// The same PID and speed as follow_segment().
+		int proportional = ((int)position) - 2000;
+		int derivative = proportional - last_proportional;
+		integral += proportional;
+		last_proportional = proportional;
+
+		int power_difference = proportional/params[PARAM_P_DIV] + integral/params[PARAM_I_DIV] + derivative*params[PARAM_D_HALVES]/2;
+
+		const int power_max = params[PARAM_SPEED]; // the maximum speed
+		if(power_difference > power_max)
+			power_difference = power_max;
+		if(power_difference < -power_max)
+			power_difference = -power_max;
+		
+		if(power_difference < 0)
+			drive_motors(power_max+power_difference,power_max);
+		else
+			drive_motors(power_max,power_max-power_difference);
+
+		if(sensors[1] < params[PARAM_LOST] && sensors[2] < params[PARAM_LOST] && sensors[3] < params[PARAM_LOST])
+		{
+			// Dead end, once it has lasted.
+      if (++lost_ticks < LOST_TICKS)
+        continue;
+			beacon(BEACON_INTERSECTION);
+			return intersections_seen;
+		}
+    lost_ticks = 0;
+    
+		if(sensors[0] > params[PARAM_LINE] || sensors[4] > params[PARAM_LINE])
+		{
+			// Found an intersection.
+      if (!on_intersection)
+      {
+        beacon(BEACON_INTERSECTION);
+        on_intersection = true;
+        intersections_seen++;
+        last_node_ms = get_ms();
+      }
+      if (intersections_seen > intersections_to_ignore)
+			  return intersections_seen;
+		}
+    else
+      on_intersection = false;
+	}
+}
+
+bool find_line(int last_proportional)
+{
+  // a positive proportional means the line was to the right
+  int spin = (last_proportional > 0) ? LINE_SEARCH_SPEED : -LINE_SEARCH_SPEED;
+
+  for (uint8_t sweep = 0; sweep < 3; sweep++)
+  {
+    int16_t sweep_ms = (sweep == 1) ? 2 * LINE_SEARCH_MS : LINE_SEARCH_MS;
+    int16_t begin_ms = get_ms();
+
+    drive_motors(spin, -spin);
+    while ((int16_t)get_ms() - begin_ms < sweep_ms)
+    {
+      wait_for_tick();
+
+      unsigned int sensors[5];
+      read_line(sensors,IR_EMITTERS_ON);
+      if (sensors[1] > params[PARAM_LINE] || sensors[2] > params[PARAM_LINE] || sensors[3] > params[PARAM_LINE])
+        return true;
+    }
+    spin = -spin;
+  }
+
+  drive_motors(0, 0);
+  return false;
+}
+
+// How long after setting off follow_segment_aggressive() has certainly
+// gone past the end of a segment seg_length long: the time at full speed
+// up to the braking point, the two braking cells, which take about three
+// cells' time, and one more, half a cell at the crawl braking ends at,
+// which is more than the timing is ever out by.  Below full power every
+// cell takes longer in proportion, so a lower top_speed can't look like
+// an overshoot.
+static int16_t overrun_ms(uint16_t seg_length, uint8_t top_speed)
+{
+  long ms = ((long)params[PARAM_FAST_CELL_MS] * ((int16_t)seg_length + 2 * SEG_LENGTH_SCALE)) / SEG_LENGTH_SCALE + 58;
+  return ms * 255 / top_speed;
+}
+
+// Like follow_segment_continuous(), but fast, braking in time to stop
+// seg_length from the start.  As there, the intersection or finish
+// square the robot starts on isn't counted.
+//
+// seg_lengths, if given, holds the lengths of the pieces of the segment
+// between the intersections to ignore.  Each one passed is a known
+// point on the map, so the braking point is worked out again from there
+// rather than built up from the start.  The motors never go over
+// top_speed; braking is still timed for full speed, so a lower limit
+// just brakes a little early.  Returns the number of intersections
+// seen, as follow_segment_continuous() does.
+//
+// Losing the line more than half a cell short of where it should stop
+// is taken for a skid rather than a dead end: the robot looks for the
+// line and, if it finds it, carries on with what it works out is left
+// of the segment, timing the rest from that alone since it no longer
+// knows how far into a piece it is.  Ending
+// well after it should have, at a dead end or an intersection, means it
+// missed the one it was meant to stop at; that sets overshot, and the
+// robot is then between that one and the next.
+uint8_t follow_segment_aggressive(uint16_t seg_length, const uint8_t *seg_lengths, uint8_t intersections_to_ignore, uint8_t top_speed)
 {
 	int last_proportional = 0;
 	long integral=0;
 
+	beacon(BEACON_SEGMENT_START);
+
   int16_t begin_ms = get_ms();
   uint8_t intersections_seen = 0;
-  bool on_intersection = 0;
+  bool on_intersection = true;
+  uint8_t searches_left = LINE_SEARCHES;
+  uint8_t lost_ticks = 0;
 
-  seg_length -= 2;
-  int16_t const full_speed_ms = 137 * (seg_length) + 58;
+  last_node_ms = begin_ms;
+  overshot = false;
 
+  // PARAM_FAST_CELL_MS (137) per cell at full speed, less two cells to
+  // brake in, plus 58 ms lost getting up to speed
+  int16_t full_speed_ms = ((long)params[PARAM_FAST_CELL_MS] * ((int16_t)seg_length - 2 * SEG_LENGTH_SCALE)) / SEG_LENGTH_SCALE + 58;
+  int16_t late_ms = overrun_ms(seg_length, top_speed);
+
+	start_ticks();
 	while(1)
 	{
     /*if (!is_playing())
@@ -104,9 +283,12 @@ void follow_segment_aggressive(int8_t seg_length, uint8_t intersections_to_ignor
 		// similar to the 3pi-linefollower-pid example, but the maximum
 		// speed is turned down to 60 for reliability.
 
+		wait_for_tick();
+
 		// Get the position of the line.
 		unsigned int sensors[5];
 		unsigned int position = read_line(sensors,IR_EMITTERS_ON);
+		adapt_calibration(sensors, position);
 
 		// The "proportional" term should be 0 when we are on the line.
 		int proportional = ((int)position) - 2000;
@@ -124,7 +306,7 @@ void follow_segment_aggressive(int8_t seg_length, uint8_t intersections_to_ignor
 		// to the left.  If it is a negative number, the robot will
 		// turn to the right, and the magnitude of the number determines
 		// the sharpness of the turn.
-		int power_difference = proportional/20 + integral/10000 + derivative*3/2;
+		int power_difference = proportional/params[PARAM_P_DIV] + integral/params[PARAM_I_DIV] + derivative*params[PARAM_D_HALVES]/2;
 
 		// Compute the actual motor settings.  We never set either motor
 		// to a negative value.
@@ -132,8 +314,8 @@ void follow_segment_aggressive(int8_t seg_length, uint8_t intersections_to_ignor
 		
     int16_t elapsed_ms = (int16_t)get_ms() - begin_ms;
     int accel_max  = 60 + elapsed_ms;
-    if (accel_max > 255)
-      accel_max = 255;
+    if (accel_max > top_speed)
+      accel_max = top_speed;
     
     int16_t diff_ms = elapsed_ms - full_speed_ms;
     int decel_max = 255;
@@ -143,6 +325,7 @@ void follow_segment_aggressive(int8_t seg_length, uint8_t intersections_to_ignor
       decel_max = 255  - (diff_ms / 2);
     
     int power_max = min(accel_max, decel_max);
+    exit_power = power_max;
     
 		if(power_difference > power_max)
 			power_difference = power_max;
@@ -150,25 +333,88 @@ void follow_segment_aggressive(int8_t seg_length, uint8_t intersections_to_ignor
 			power_difference = -power_max;
 
 		if(power_difference < 0)
-			set_motors(power_max+power_difference,power_max);
+			drive_motors(power_max+power_difference,power_max);
 		else
-			set_motors(power_max,power_max-power_difference);
+			drive_motors(power_max,power_max-power_difference);
 
 		// We use the inner three sensors (1, 2, and 3) for
 		// determining whether there is a line straight ahead, and the
 		// sensors 0 and 4 for detecting lines going to the left and
 		// right.
 
-		if(sensors[0] > 200 || sensors[4] > 200)
+    bool late = elapsed_ms > late_ms;
+
+		if(sensors[1] < params[PARAM_LOST] && sensors[2] < params[PARAM_LOST] && sensors[3] < params[PARAM_LOST])
+		{
+      if (++lost_ticks < LOST_TICKS)
+        continue;
+      lost_ticks = 0;
+      
+      // What's left: before braking, two cells plus the time still to
+      // go at full speed; while braking, what's left of the two cells
+      // over the three cells' time they take.  A segment shorter than
+      // two cells is braking from the start.
+      long length_left;
+      if (diff_ms < 0)
+        length_left = 2 * SEG_LENGTH_SCALE + ((long)-diff_ms * SEG_LENGTH_SCALE) / params[PARAM_FAST_CELL_MS];
+      else
+        length_left = 2 * SEG_LENGTH_SCALE - ((long)diff_ms * 2 * SEG_LENGTH_SCALE) / (3 * params[PARAM_FAST_CELL_MS]);
+      if (length_left > (int16_t)seg_length)
+        length_left = seg_length;
+
+      if (length_left > SEG_LENGTH_SCALE / 2 && searches_left)
+      {
+        // Lost the line with more than half a cell to go; if the line
+        // turns up, set off again from there.
+        searches_left--;
+        if (find_line(last_proportional))
+        {
+          seg_length = length_left;
+          seg_lengths = NULL;
+          begin_ms = get_ms();
+          full_speed_ms = ((long)params[PARAM_FAST_CELL_MS] * ((int16_t)seg_length - 2 * SEG_LENGTH_SCALE)) / SEG_LENGTH_SCALE + 58;
+          late_ms = overrun_ms(seg_length, top_speed);
+          last_proportional = 0;
+          integral = 0;
+          continue;
+        }
+      }
+
+			// Dead end: the line isn't where the path expects it.
+			beacon(BEACON_INTERSECTION);
+      overshot = late;
+			return intersections_seen;
+		}
+    lost_ticks = 0;
+    
+		if(sensors[0] > params[PARAM_LINE] || sensors[4] > params[PARAM_LINE])
 		{
 			// Found an intersection.
       if (!on_intersection)
       {
+        beacon(BEACON_INTERSECTION);
         on_intersection = true;
         intersections_seen++;
+        last_node_ms = get_ms();
+        if (intersections_seen > intersections_to_ignore)
+          overshot = late;
+
+        if (seg_lengths && intersections_seen <= intersections_to_ignore)
+        {
+          // brake from the distance left after this intersection; any
+          // of the 195 ms ramp still to come costs its share of the 58 ms
+          if (seg_length > seg_lengths[intersections_seen - 1])
+            seg_length -= seg_lengths[intersections_seen - 1];
+          else
+            seg_length = 0;
+          full_speed_ms = elapsed_ms + ((long)params[PARAM_FAST_CELL_MS] * ((int16_t)seg_length - 2 * SEG_LENGTH_SCALE)) / SEG_LENGTH_SCALE;
+          if (elapsed_ms < 195)
+            full_speed_ms += 58 * (195 - elapsed_ms) / 195;
+          late_ms = elapsed_ms + overrun_ms(seg_length, top_speed) - 58;
+        }
       }
       if (intersections_seen > intersections_to_ignore)
-			  return;
+			  return intersections_seen;
 		}
     else
       on_intersection = false;
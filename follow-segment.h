@@ -1,2 +1,36 @@
+#ifndef __follow_segment_h
+#define __follow_segment_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Segment lengths are passed around in fixed point, in units of
+// 1/SEG_LENGTH_SCALE of a maze cell.
+#define SEG_LENGTH_SCALE 16
+
 void follow_segment();
-void follow_segment_aggressive(uint8_t seg_length, uint8_t intersections_to_ignore);
\ No newline at end of file
+uint8_t follow_segment_continuous(uint8_t intersections_to_ignore);
+
+// get_ms() when follow_segment_continuous() or follow_segment_aggressive()
+// last started or passed an intersection
+extern unsigned int last_node_ms;
+
+// set by follow_segment_aggressive() if it drove past the intersection
+// it should have stopped at
+extern bool overshot;
+
+// the power follow_segment_aggressive() was driving at when it stopped,
+// for the turn that follows it; anything else that stops or turns the
+// robot leaves it stale, so read it straight after the call
+extern uint8_t exit_power;
+
+uint8_t follow_segment_aggressive(uint16_t seg_length, const uint8_t *seg_lengths, uint8_t intersections_to_ignore, uint8_t top_speed);
+
+// Looks for the line after losing it at speed: turns toward the side it
+// was last seen on, a positive last_proportional being the right, across
+// to the other and back to the middle.  Returns true, with the line
+// under the middle sensors, as soon as it finds it, or false facing the
+// way it started.
+bool find_line(int last_proportional);
+
+#endif
@@ -24,8 +24,13 @@
 
 #include "bargraph.h"
 #include "maze-solve.h"
+#include "map-link.h"
 #include "sounds.h"
 #include "calibrate.h"
+#include "motors.h"
+#include "params.h"
+#include "display.h"
+#include "profiles.h"
 
 // Introductory messages.  The "PROGMEM" identifier causes the data to
 // go into program space.
@@ -34,6 +39,35 @@ const char welcome_line2[] PROGMEM = "3\xf7 Robot";
 const char demo_name_line1[] PROGMEM = "Maze";
 const char demo_name_line2[] PROGMEM = "solver";
 
+// Below this the motors can't be scaled up to the speeds everything
+// was tuned at.
+#define START_MIN_MV (NOMINAL_BATTERY_MV * 5 / 6)
+
+// Checks the robot is fit to set off: a line under the middle sensors,
+// but not every sensor black, which is what they read when the robot is
+// off the floor, and a battery that isn't flat.  Returns what's wrong,
+// for the LCD, or 0 if nothing is.
+const char *start_problem()
+{
+	unsigned int sensors[5];
+	read_line(sensors,IR_EMITTERS_ON);
+
+	bool line = sensors[1] > params[PARAM_LINE] || sensors[2] > params[PARAM_LINE] || sensors[3] > params[PARAM_LINE];
+	bool all_black = true;
+	for (uint8_t i = 0; i < 5; i++)
+	{
+		if (sensors[i] < params[PARAM_FINISH])
+			all_black = false;
+	}
+	if (!line || all_black)
+		return "Sensors?";
+
+	if (read_battery_millivolts() < START_MIN_MV)
+		return "Battery?";
+
+	return 0;
+}
+
 // Initializes the 3pi, displays a welcome message, calibrates, and
 // plays the initial music.
 void initialize()
@@ -41,60 +75,73 @@ void initialize()
   unsigned int sensors[5]; // an array to hold sensor values
   
 	// This must be called at the beginning of 3pi code, to set up the
-	// sensors.  We use a value of 2000 for the timeout, which
-	// corresponds to 2000*0.4 us = 0.8 ms on our 20 MHz processor.
-	pololu_3pi_init(2000);
+	// sensors.  Calibrating uses a timeout of 2000, which corresponds
+	// to 2000*0.4 us = 0.8 ms on our 20 MHz processor; otherwise it is
+	// shortened to suit the stored calibration.
+	bool calibrate = !check_stored_calibration() || button_is_pressed(BUTTON_C);
+	init_3pi(calibrate);
 	load_custom_characters(); // load the custom characters
   
-  if (!check_stored_calibration() || button_is_pressed(BUTTON_C))
+  if (calibrate)
     perform_calibration(); // loops forever when done
   
+  load_params();
+  if (button_is_pressed(BUTTON_B))
+    edit_params();
+
+  // A held at power-on forgets every stored maze, for a new set of
+  // mazes; it has to be let go before A can start a run.
+  if (button_is_pressed(BUTTON_A))
+  {
+    clear_profiles();
+    clear();
+    print("Forgot");
+    lcd_goto_xy(0,1);
+    print("mazes");
+    wait_for_button_release(BUTTON_A);
+  }
+  
 	play_from_program_space(welcome_sound);
 
-	// Display battery voltage for 2 s or until button press
-	while(millis() < 2000 && !button_is_pressed(BUTTON_A))
+	load_stored_calibration();
+
+	// Display the battery voltage and the calibrated values as a bar
+	// graph, which shows the robot is ready to go, until A is pressed.
+	// The robot sets off as soon as A is let go, if it looks ready.
+	while(1)
 	{
+		read_line(sensors,IR_EMITTERS_ON);
 		int bat = read_battery_millivolts();
 
 		clear();
 		print_long(bat);
 		print("mV");
 		lcd_goto_xy(0,1);
-		print("Press B");
-
-		delay_ms(100);
-	}
-  wait_for_button_release(BUTTON_A);
+		display_readings(sensors);
 
-	load_stored_calibration();
+		if (button_is_pressed(BUTTON_A))
+		{
+			wait_for_button_release(BUTTON_A);
 
-	// Display calibrated values as a bar graph.
-	while(!button_is_pressed(BUTTON_A))
-	{
-		// Read the sensor values and get the position measurement.
-		unsigned int position = read_line(sensors,IR_EMITTERS_ON);
-
-		// Display the position measurement, which will go from 0
-		// (when the leftmost sensor is over the line) to 4000 (when
-		// the rightmost sensor is over the line) on the 3pi, along
-		// with a bar graph of the sensor readings.  This allows you
-		// to make sure the robot is ready to go.
-		clear();
-		print_long(position);
-		lcd_goto_xy(0,1);
-		display_readings(sensors);
+			const char *problem = start_problem();
+			if (!problem)
+				break;
+			clear();
+			print(problem);
+			play("!<c8");
+			delay_ms(500);
+		}
 
 		delay_ms(100);
 	}
-	wait_for_button_release(BUTTON_A);
 
 	clear();
 
-	print("Go!");		
+	print("Go!");
+	sample_battery();		
 
-	// Play music and wait for it to finish before we start driving.
+	// The start cue plays while we drive.
 	play_from_program_space(go_sound);
-	while(is_playing());
 }
 
 // This is the main function, where the code starts.  All C programs
@@ -111,19 +158,52 @@ int main()
   // times as we want to.
   while(1)
   {    
-    unsigned char button = wait_for_button(BUTTON_A | BUTTON_C);
+    // Offer the map to a host, which may send a better plan back
+    // while we wait.
+    send_map();
+    start_plan_receive();
+    
+    unsigned char button;
+    while (!(button = get_single_debounced_button_press(BUTTON_A | BUTTON_B | BUTTON_C)))
+    {
+      if (check_plan_received())
+        play_from_program_space(done_sound);
+    }
+    delay_ms(30); // give the other button a chance to go down too
+    bool laps = button_is_pressed(BUTTON_A) && button_is_pressed(BUTTON_C);
+    wait_for_button_release(BUTTON_A | BUTTON_B | BUTTON_C);
+    stop_plan_receive();
+    
+    const char *problem = start_problem();
+    if (problem)
+    {
+      // wait for another press once it's put right
+      display_clear();
+      display_print(problem);
+      display_flush(DISPLAY_CHARS);
+      play("!<c8");
+      continue;
+    }
+    
+    // the start cue plays while we drive
     play_from_program_space(go_sound);
-	  while (is_playing());
 
-    if (button == BUTTON_A)
+    if (laps)
+    {
+      // A and C together: back and forth until a button is held
+      run_laps();
+    }
+    else if (button == BUTTON_A)
     {
       run_maze_aggressive();
     }
+    else if (button == BUTTON_B)
+    {
+      run_maze_continuous();
+    }
     else
     {
-      set_digital_output(IO_D0, LOW);
       run_maze_conservative();
-      set_digital_input(IO_D0, PULL_UP_ENABLED);
     } 
   }
 }
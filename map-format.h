@@ -0,0 +1,63 @@
+/*
+ * The serial formats for sending a map to a host and a plan back, shared
+ * by map-link.c and tools/mapplan.c.  All multi-byte values are little
+ * endian.
+ *
+ * Map, sent by the robot after mapping:
+ *
+ *   'M' 'Z' MAP_FORMAT_VERSION size start.x start.y finish.x finish.y
+ *   then size * size cells, x fastest, of two bytes each:
+ *     edges  MAP_NORTH_EDGE | MAP_EAST_EDGE | MAP_NORTH_SEEN | MAP_EAST_SEEN
+ *     trims  north trim in the low nibble, east in the high, signed
+ *   then the Fletcher-16 checksum of everything before it
+ *
+ * Edges are stored on their south or west cell, as on the robot, and
+ * cell lengths are SEG_LENGTH_SCALE + trim sixteenths of a cell.
+ *
+ * Plan, sent back by the host:
+ *
+ *   'P' 'L' PLAN_FORMAT_VERSION n
+ *   then n turns ('L', 'R', 'S', 'B', ending with 'X'),
+ *   n segment lengths in 1/SEG_LENGTH_SCALE cells, before each turn,
+ *   n top speeds for the straight before each turn, 0 for the default,
+ *   then the Fletcher-16 checksum of everything before it
+ */
+
+#ifndef __map_format_h
+#define __map_format_h
+
+#include <stdint.h>
+
+#define MAP_FORMAT_VERSION  1
+#define PLAN_FORMAT_VERSION 1
+
+#define MAP_HEADER_SIZE  8
+#define PLAN_HEADER_SIZE 4
+
+#define MAP_NORTH_EDGE 0x01
+#define MAP_EAST_EDGE  0x02
+#define MAP_NORTH_SEEN 0x04 // seen but never driven
+#define MAP_EAST_SEEN  0x08
+
+#define MAP_BAUD_RATE 38400
+
+typedef struct fletcher16
+{
+  uint8_t sum1, sum2;
+} fletcher16;
+
+static inline void fletcher16_update(fletcher16 *f, const uint8_t *data, uint16_t length)
+{
+  while (length--)
+  {
+    f->sum1 = (f->sum1 + *data++) % 255;
+    f->sum2 = (f->sum2 + f->sum1) % 255;
+  }
+}
+
+static inline uint16_t fletcher16_value(const fletcher16 *f)
+{
+  return ((uint16_t)f->sum2 << 8) | f->sum1;
+}
+
+#endif
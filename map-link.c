@@ -0,0 +1,132 @@
+/*
+ * The serial end of map-format.h: the map goes out after mapping and
+ * after each run, and a plan can come back while the robot waits for a
+ * button.  A plan that arrives broken is thrown away and the robot's own
+ * path is rebuilt in its place.  A fast run that follows a plan to the
+ * finish leaves it in place.  The conservative run, and a fast run that
+ * has to find its own way, go by the map and may change it, so they
+ * replace a plan with the robot's own path, and the map is sent again
+ * so the host can plan afresh.
+ */
+
+#include <pololu/3pi.h>
+#include "maze-config.h"
+#include "map-format.h"
+#include "map-link.h"
+#include "maze-map.h"
+
+// how long to wait for each part of a plan once it has started
+#define PLAN_TIMEOUT_MS 100
+
+fletcher16 link_sum;
+char plan_byte; // the first byte of a plan, received in the background
+
+void send_summed(uint8_t *data, uint8_t length)
+{
+  fletcher16_update(&link_sum, data, length);
+  serial_send_blocking((char *)data, length);
+}
+
+void send_map()
+{
+  uint8_t header[MAP_HEADER_SIZE] = { 'M', 'Z', MAP_FORMAT_VERSION, MAZE_SIZE };
+  uint8_t row[MAZE_SIZE * 2];
+  
+  serial_set_baud_rate(MAP_BAUD_RATE);
+  link_sum = (fletcher16){ 0, 0 };
+  
+  get_map_ends(&header[4]);
+  send_summed(header, sizeof(header));
+  
+  // a row at a time, so only one row is ever copied
+  for (int8_t y = 0; y < MAZE_SIZE; y++)
+  {
+    for (int8_t x = 0; x < MAZE_SIZE; x++)
+    {
+      row[x * 2] = get_map_edges(x, y);
+      row[x * 2 + 1] = get_map_trims(x, y);
+    }
+    send_summed(row, sizeof(row));
+  }
+  
+  uint16_t sum = fletcher16_value(&link_sum);
+  uint8_t tail[2] = { sum & 0xff, sum >> 8 };
+  serial_send_blocking((char *)tail, sizeof(tail));
+}
+
+void start_plan_receive()
+{
+  serial_set_baud_rate(MAP_BAUD_RATE);
+  UCSR0B |= 1 << RXEN0;
+  serial_receive(&plan_byte, 1);
+}
+
+void stop_plan_receive()
+{
+  serial_cancel_receive();
+  UCSR0B &= ~(1 << RXEN0); // hand PD0 back to the beacon
+}
+
+bool receive_summed(uint8_t *data, uint8_t length)
+{
+  if (serial_receive_blocking((char *)data, length, PLAN_TIMEOUT_MS))
+    return false; // timed out
+  fletcher16_update(&link_sum, data, length);
+  return true;
+}
+
+// Checks the plan now in the path; the runs trust its turns.
+bool plan_is_sound(uint8_t n)
+{
+  uint8_t tail[2];
+  
+  if (serial_receive_blocking((char *)tail, sizeof(tail), PLAN_TIMEOUT_MS))
+    return false;
+  if ((tail[0] | (tail[1] << 8)) != fletcher16_value(&link_sum))
+    return false;
+  
+  for (uint8_t i = 0; i < n - 1; i++)
+  {
+    if (path[i] != 'L' && path[i] != 'R' && path[i] != 'S' && path[i] != 'B')
+      return false;
+  }
+  return path[n - 1] == 'X';
+}
+
+// Reads the rest of a plan straight into the path, to save the RAM of a
+// second copy.  Returns false if it was broken, having rebuilt the path
+// if any of it had been overwritten.
+bool receive_plan()
+{
+  uint8_t header[PLAN_HEADER_SIZE] = { 'P' };
+  
+  link_sum = (fletcher16){ 0, 0 };
+  fletcher16_update(&link_sum, header, 1);
+  
+  if (!receive_summed(&header[1], PLAN_HEADER_SIZE - 1))
+    return false;
+  
+  uint8_t n = header[3];
+  if (header[1] != 'L' || header[2] != PLAN_FORMAT_VERSION || n == 0 || n > MAX_PATH_LENGTH)
+    return false; // noise, or not for us; the path is untouched
+  
+  if (!receive_summed((uint8_t *)path, n) || !receive_summed(path_seg_lengths, n)
+    || !receive_summed(path_speeds, n) || !plan_is_sound(n))
+  {
+    build_path();
+    return false;
+  }
+  
+  path_length = n;
+  return true;
+}
+
+bool check_plan_received()
+{
+  if (!serial_receive_buffer_full())
+    return false;
+  
+  bool received = (plan_byte == 'P') && receive_plan();
+  serial_receive(&plan_byte, 1);
+  return received;
+}
@@ -0,0 +1,22 @@
+/*
+ * Sends the map to a host after mapping and takes a plan back between
+ * runs, in the formats of map-format.h.  See tools/mapplan.c for the
+ * host end.
+ */
+
+#ifndef __map_link_h
+#define __map_link_h
+
+#include <stdbool.h>
+
+void send_map();
+
+// The receiver shares PD0 with beacon.h, so it is only switched on
+// while the robot waits between runs.
+void start_plan_receive();
+void stop_plan_receive();
+
+// Polls for a plan; returns true once one has replaced the path.
+bool check_plan_received();
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ * Sizes of the map and the planner, fixed at compile time per target.
+ *
+ * Each MCU gets the largest square map that fits its MAZE_RAM_BUDGET,
+ * the RAM left for the map, the path and the cost queue once the Pololu
+ * library, the stack and everything else have had theirs.  maze-solve.c
+ * checks the budget with a static assertion.  Any of these can be
+ * overridden with -D, for example to try a bigger map on the host.
+ */
+
+#ifndef __maze_config_h
+#define __maze_config_h
+
+#include <stdint.h>
+
+#if defined(__AVR_ATmega168__)
+
+// 1 KB of RAM: 9x9 cells at 3 bytes, 36 path entries at 3, 16 queue
+// entries at 2
+#define MAZE_RAM_BUDGET      384
+#define DEFAULT_MAZE_SIZE      9
+#define DEFAULT_PATH_LENGTH   36
+#define DEFAULT_QUEUE_SIZE    16
+
+// 512 bytes of EEPROM, less 64 for the parameters and calibration
+#define PROFILE_EEPROM_BUDGET 448
+#define DEFAULT_PROFILE_COUNT   3
+
+#elif defined(__AVR_ATmega328P__)
+
+// 2 KB of RAM: 16x16 cells at 3 bytes, 100 path entries at 3, 32 queue
+// entries at 2.  17x17 would need 16-bit costs, and 4 bytes a cell.
+#define MAZE_RAM_BUDGET     1408
+#define DEFAULT_MAZE_SIZE     16
+#define DEFAULT_PATH_LENGTH  100
+#define DEFAULT_QUEUE_SIZE    32
+
+// 1 KB of EEPROM, less 64 for the parameters and calibration
+#define PROFILE_EEPROM_BUDGET 960
+#define DEFAULT_PROFILE_COUNT   3
+
+#else
+
+// the host tools, which match the 328p unless told otherwise so that
+// they check what gets flashed
+#define DEFAULT_MAZE_SIZE     16
+#define DEFAULT_PATH_LENGTH  100
+#define DEFAULT_QUEUE_SIZE    32
+#define DEFAULT_PROFILE_COUNT  3
+
+#endif
+
+#ifndef MAZE_SIZE
+#define MAZE_SIZE DEFAULT_MAZE_SIZE
+#endif
+
+#ifndef MAX_PATH_LENGTH
+#define MAX_PATH_LENGTH DEFAULT_PATH_LENGTH
+#endif
+
+#ifndef COST_QUEUE_SIZE
+#define COST_QUEUE_SIZE DEFAULT_QUEUE_SIZE
+#endif
+
+// solved mazes kept in EEPROM, see profiles.c
+#ifndef PROFILE_COUNT
+#define PROFILE_COUNT DEFAULT_PROFILE_COUNT
+#endif
+
+// A cost counts cells, so a route can only cost more than 254 on a map
+// of more than 16x16 cells.
+#ifndef COST_BITS
+#if MAZE_SIZE <= 16
+#define COST_BITS 8
+#else
+#define COST_BITS 16
+#endif
+#endif
+
+#if COST_BITS == 8
+typedef uint8_t cost_t;
+#define MAX_COST UINT8_MAX
+#else
+typedef uint16_t cost_t;
+#define MAX_COST UINT16_MAX
+#endif
+
+// positions are int8_t, and stepping off the map must stay in range
+#define MAX_MAZE_SIZE 64
+_Static_assert(MAZE_SIZE >= 4 && MAZE_SIZE <= MAX_MAZE_SIZE, "MAZE_SIZE out of range");
+_Static_assert(MAX_PATH_LENGTH <= UINT8_MAX, "path_length is a uint8_t");
+_Static_assert(COST_QUEUE_SIZE <= UINT8_MAX, "the cost queue is indexed by uint8_t");
+_Static_assert(COST_BITS == 16 || MAZE_SIZE <= 16, "8-bit costs are too narrow for this map");
+
+#endif
@@ -0,0 +1,699 @@
+/*
+ * This file contains the map of the maze and the planner that finds the
+ * way to the finish on it.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "display.h"
+#include "map-format.h"
+#include "maze-map.h"
+#include "scheduler.h"
+
+node maze[MAZE_SIZE][MAZE_SIZE]; // x, y
+
+
+// state info
+
+uint8_t dir;
+pos start, here, prev, finish;
+uint8_t start_dir; // the way the robot faces at the start: NORTH, except in lap mode
+bool recorded_finish;
+
+bool found_left, found_straight, found_right;
+uint8_t dir_marks[4];
+
+
+// used by build_path()
+
+uint8_t dir_to_finish_here;
+
+// The path is built a cell at a time, so that it can be done in the
+// background while mapping.  Its walk has its own position and heading,
+// apart from the robot's.
+pos path_here;
+uint8_t path_dir;
+uint16_t path_seg_length; // measured length since the last path segment
+
+// cells relaxed or walked per background slice
+#define PLAN_SLICE 8
+
+
+// cost repair queue
+
+// Costs are kept current while mapping.  Each new segment pushes its two
+// ends here and relax_costs() spreads any improvement outward from them,
+// so only the cells whose cost actually drops get touched.  If the queue
+// overflows, every costed cell is pushed again; slow, but still correct.
+// In the background that is done a slice at a time, from reseed_cell.
+
+pos cost_queue[COST_QUEUE_SIZE];
+uint8_t cost_queue_head, cost_queue_length;
+bool cost_queue_overflowed;
+uint16_t reseed_cell = MAZE_SIZE * MAZE_SIZE; // all pushed
+
+
+// final path
+
+char path[MAX_PATH_LENGTH];
+// In 1/SEG_LENGTH_SCALE cells, and a byte each like the profiles and
+// the plans from map-link.c, so add_path_segment() clamps them just
+// short of 16 cells.  A clamped entry would brake early and could look
+// like an overshoot, but mapping keeps a cell clear all round the map,
+// so no corridor on the robot's maps comes near it; only bigger host
+// maps can.
+uint8_t path_seg_lengths[MAX_PATH_LENGTH];
+uint8_t path_speeds[MAX_PATH_LENGTH]; // top speed before each turn, 0 for full; only a host plan sets these
+uint8_t path_length; // the length of the path
+
+#ifdef MAZE_RAM_BUDGET
+_Static_assert((MAZE_SIZE - 3) * SEG_LENGTH_SCALE + SEG_LENGTH_SCALE / 2 <= UINT8_MAX,
+  "a corridor across the map doesn't fit path_seg_lengths");
+_Static_assert(sizeof(maze) + sizeof(path) + sizeof(path_seg_lengths) + sizeof(path_speeds) + sizeof(cost_queue) <= MAZE_RAM_BUDGET,
+  "the map doesn't fit this MCU; see maze-config.h");
+#endif
+
+
+void clear_map()
+{
+  for (uint8_t y = 0; y < MAZE_SIZE; y++)
+  {
+    for (uint8_t x = 0; x < MAZE_SIZE; x++)
+      maze[x][y] = (node){ .cost = MAX_COST, .marks = 0, .trims = 0 };
+  }
+}
+
+node *exit_node(int8_t x, int8_t y, uint8_t d)
+{
+  if (d == SOUTH)
+    y--;
+  if (d == WEST)
+    x--;
+  return &maze[x][y];
+}
+
+// The trim of the edge leaving (x, y) in direction d.
+int8_t get_exit_trim(int8_t x, int8_t y, uint8_t d)
+{
+  if (d == SOUTH)
+    y--;
+  if (d == WEST)
+    x--;
+  return (d & 1) ? get_east_trim(x, y) : get_north_trim(x, y);
+}
+
+void set_exit_trim(int8_t x, int8_t y, uint8_t d, int8_t trim)
+{
+  if (d == SOUTH)
+    y--;
+  if (d == WEST)
+    x--;
+  if (d & 1)
+    set_east_trim(x, y, trim);
+  else
+    set_north_trim(x, y, trim);
+}
+
+// True if a robot heading d through (x, y) drives straight on, without
+// stopping: the map has a line ahead and no exits to the sides.
+bool is_corridor(int8_t x, int8_t y, uint8_t d)
+{
+  return has_mapped_exit(x, y, d) && !has_exit(x, y, left_of(d)) && !has_exit(x, y, right_of(d)) &&
+         !((x == finish.x) && (y == finish.y));
+}
+
+// Takes the line leaving (x, y) in direction d off the map, as far as
+// the next node, for when it turns out not to be there any more.
+void remove_branch(int8_t x, int8_t y, uint8_t d)
+{
+  do
+  {
+    node *n = exit_node(x, y, d);
+    n->marks &= ~(exit_mark_mask(d) | exit_seen(d));
+    n->trims &= ~exit_trim_mask(d);
+    x = step_x(x, d);
+    y = step_y(y, d);
+  } while (is_corridor(x, y, d));
+}
+
+// Forgets the exit leaving (x, y) in direction d.  Returns true if it
+// was a mapped line, in which case the costs need refilling.
+bool forget_exit(int8_t x, int8_t y, uint8_t d)
+{
+  if (has_mapped_exit(x, y, d))
+  {
+    remove_branch(x, y, d);
+    return true;
+  }
+  
+  exit_node(x, y, d)->marks &= ~exit_seen(d);
+  return false;
+}
+
+// Records an exit found at (x, y) that isn't on the map yet.
+void see_exit(int8_t x, int8_t y, uint8_t d)
+{
+  if (!has_exit(x, y, d))
+    exit_node(x, y, d)->marks |= exit_seen(d);
+}
+
+// Moves here along dir to the next place the robot would stop: an
+// intersection, a dead end or the finish.
+void advance_to_next_node()
+{
+  do
+  {
+    here.x = step_x(here.x, dir);
+    here.y = step_y(here.y, dir);
+  } while (is_corridor(here.x, here.y, dir));
+}
+
+// Queued cost repairs and a half-built path hold map positions, so any
+// planning in progress is finished before the map moves under it.
+void shift_map_north(uint8_t amt)
+{
+  finish_background();
+  
+  for (int8_t y = (MAZE_SIZE - 1); y >= 0; y--) 
+  {
+    for (int8_t x = 0; x < MAZE_SIZE; x++)
+    {
+      if (y >= amt)
+        maze[x][y] = maze[x][y - amt];
+      else
+        maze[x][y] = (node){ .cost = MAX_COST, .marks = 0, .trims = 0 };
+    }
+  }
+  
+  start.y  += amt;
+  here.y   += amt;
+  prev.y   += amt;
+  finish.y += amt;
+}
+
+void shift_map_east(uint8_t amt)
+{
+  finish_background();
+  
+  for (int8_t x = (MAZE_SIZE - 1); x >= 0; x--)
+  {
+    for (int8_t y = 0; y < MAZE_SIZE; y++)
+    {
+      if (x >= amt)
+        maze[x][y] = maze[x - amt][y];
+      else
+        maze[x][y] = (node){ .cost = MAX_COST, .marks = 0, .trims = 0 };
+    }
+  }
+  
+   start.x  += amt;
+   here.x   += amt;
+   prev.x   += amt;
+   finish.x += amt;
+}
+
+void shift_map_south(uint8_t amt)
+{
+  finish_background();
+  
+  for (int8_t y = 0; y < MAZE_SIZE; y++)
+  {
+    for (int8_t x = 0; x < MAZE_SIZE; x++)
+    {
+      if (y < (MAZE_SIZE - amt))
+        maze[x][y] = maze[x][y + amt];
+      else
+        maze[x][y] = (node){ .cost = MAX_COST, .marks = 0, .trims = 0 };
+    }
+  }
+  
+  start.y  -= amt;
+  here.y   -= amt;
+  prev.y   -= amt;
+  finish.y -= amt;
+}
+
+void shift_map_west(uint8_t amt)
+{
+  finish_background();
+  
+  for (int8_t x = 0; x < MAZE_SIZE; x++)
+  {
+    for (int8_t y = 0; y < MAZE_SIZE; y++)
+    {
+      if (x < (MAZE_SIZE - amt))
+        maze[x][y] = maze[x + amt][y];
+      else
+        maze[x][y] = (node){ .cost = MAX_COST, .marks = 0, .trims = 0 };
+    }
+  }
+  
+  start.x  -= amt;
+  here.x   -= amt;
+  prev.x   -= amt;
+  finish.x -= amt;
+}
+
+// Stores the trim of a segment on one of its edges, averaging it with
+// the previous measurement if the edge has been driven before.
+void merge_north_trim(int8_t x, int8_t y, int8_t trim)
+{
+  if (get_north_marks(x, y) > 1)
+    trim = (get_north_trim(x, y) + trim) / 2;
+  set_north_trim(x, y, trim);
+}
+
+void merge_east_trim(int8_t x, int8_t y, int8_t trim)
+{
+  if (get_east_marks(x, y) > 1)
+    trim = (get_east_trim(x, y) + trim) / 2;
+  set_east_trim(x, y, trim);
+}
+
+void push_cost(int8_t x, int8_t y)
+{
+  if (maze[x][y].cost == MAX_COST)
+    return; // nothing to spread yet
+
+  if (cost_queue_length == COST_QUEUE_SIZE)
+  {
+    cost_queue_overflowed = true;
+    return;
+  }
+
+  cost_queue[(cost_queue_head + cost_queue_length) % COST_QUEUE_SIZE] = (pos){ x, y };
+  cost_queue_length++;
+}
+
+void relax_cost(int8_t x, int8_t y, cost_t cost, uint8_t dir_to_finish)
+{
+  if (cost < maze[x][y].cost)
+  {
+    maze[x][y].cost = cost;
+    set_dir_to_finish(x, y, dir_to_finish);
+    push_cost(x, y);
+  }
+}
+
+// Spreads the cost of the next queued cell to its neighbours.
+void relax_next_cost()
+{
+  pos p = cost_queue[cost_queue_head];
+  cost_queue_head = (cost_queue_head + 1) % COST_QUEUE_SIZE;
+  cost_queue_length--;
+
+  cost_t cost = maze[p.x][p.y].cost + 1;
+
+  if (get_north_marks(p.x, p.y))
+    relax_cost(p.x, p.y + 1, cost, SOUTH); // north exit
+  if (get_east_marks(p.x, p.y))
+    relax_cost(p.x + 1, p.y, cost, WEST);  // east exit
+  if (get_north_marks(p.x, p.y - 1))
+    relax_cost(p.x, p.y - 1, cost, NORTH); // south exit
+  if (get_east_marks(p.x - 1, p.y))
+    relax_cost(p.x - 1, p.y, cost, EAST);  // west exit
+}
+
+void drain_cost_queue()
+{
+  while (cost_queue_length)
+    relax_next_cost();
+}
+
+void relax_costs()
+{
+  drain_cost_queue();
+
+  while (cost_queue_overflowed)
+  {
+    cost_queue_overflowed = false;
+
+    for (uint8_t y = 0; y < MAZE_SIZE; y++)
+    {
+      for (uint8_t x = 0; x < MAZE_SIZE; x++)
+      {
+        if (cost_queue_length == COST_QUEUE_SIZE)
+          drain_cost_queue();
+        push_cost(x, y);
+      }
+    }
+
+    drain_cost_queue();
+  }
+}
+
+// Starts the costs again from the finish, leaving relax_costs() or the
+// background planning to spread them.
+void clear_costs()
+{
+  for (uint8_t y = 0; y < MAZE_SIZE; y++)
+  {
+    for (uint8_t x = 0; x < MAZE_SIZE; x++)
+      maze[x][y].cost = MAX_COST;
+  }
+
+  // anything still queued refers to the old costs
+  cost_queue_length = 0;
+  cost_queue_overflowed = false;
+  reseed_cell = MAZE_SIZE * MAZE_SIZE;
+
+  maze[finish.x][finish.y].cost = 0; // dir_to_finish is meaningless for finish node
+  push_cost(finish.x, finish.y);
+}
+
+// Recomputes every cost from scratch.  Only needed when the map changes
+// during a run; while mapping, update_map() keeps the costs current.
+void fill_all_costs()
+{
+  clear_costs();
+  relax_costs();
+}
+
+// The map in the serial format of map-format.h, for map-link.c.
+uint8_t get_map_edges(int8_t x, int8_t y)
+{
+  uint8_t marks = maze[x][y].marks;
+  uint8_t edges = 0;
+  
+  if (marks & NORTH_MARK_MASK)
+    edges |= MAP_NORTH_EDGE;
+  else if (marks & NORTH_SEEN)
+    edges |= MAP_NORTH_SEEN;
+  if (marks & EAST_MARK_MASK)
+    edges |= MAP_EAST_EDGE;
+  else if (marks & EAST_SEEN)
+    edges |= MAP_EAST_SEEN;
+  return edges;
+}
+
+uint8_t get_map_trims(int8_t x, int8_t y)
+{
+  return maze[x][y].trims; // already north low, east high
+}
+
+void get_map_ends(uint8_t *ends)
+{
+  ends[0] = start.x;
+  ends[1] = start.y;
+  ends[2] = finish.x;
+  ends[3] = finish.y;
+}
+
+void plan_in_background(); // with the path builder, below
+
+void update_map(uint8_t seg_length, int8_t trim)
+{
+  prev = here;
+  
+  // record the most recent segment followed
+  
+  switch(dir)
+  {
+    
+  case NORTH:
+    here.y += seg_length;
+
+    if (here.y >= MAZE_SIZE)
+      shift_map_south(here.y - (MAZE_SIZE - 1));
+      
+    for (uint8_t y = prev.y; y < here.y; y++)
+      add_north_mark(here.x, y);
+
+    if (seg_length)
+      merge_north_trim(here.x, prev.y, trim);
+ 
+    break;  
+
+
+  case EAST:
+  
+    here.x += seg_length;
+      
+    if (here.x >= MAZE_SIZE)
+      shift_map_west(here.x - (MAZE_SIZE - 1));
+      
+    for (uint8_t x = prev.x; x < here.x; x++)
+      add_east_mark(x, here.y);
+
+    if (seg_length)
+      merge_east_trim(prev.x, here.y, trim);
+
+    break;
+
+
+  case SOUTH:
+  
+    here.y -= seg_length;
+      
+    if (here.y < 1)
+      shift_map_north(1 - here.y);  
+
+    for (uint8_t y = here.y; y < prev.y; y++)
+      add_north_mark(here.x, y);
+
+    if (seg_length)
+      merge_north_trim(here.x, here.y, trim);
+        
+    break;
+    
+    
+  case WEST:
+  
+    here.x -= seg_length;
+      
+    if (here.x < 1)
+      shift_map_east(1 - here.x);
+      
+    for (uint8_t x = here.x; x < prev.x; x++)
+      add_east_mark(x, here.y);
+
+    if (seg_length)
+      merge_east_trim(here.x, here.y, trim);
+
+    break;
+  }   
+    
+      
+  // store # of marks in each direction
+  dir_marks[NORTH] = get_north_marks(here.x, here.y);
+  dir_marks[EAST]  = get_east_marks(here.x, here.y);
+  dir_marks[SOUTH] = get_north_marks(here.x, here.y - 1);
+  dir_marks[WEST]  = get_east_marks(here.x - 1, here.y);
+  
+  
+  /*set_motors(0, 0);
+  clear();
+  lcd_goto_xy(1, 0);
+  print_long(dir_marks[dir]);
+  lcd_goto_xy(0, 1);
+  print_long(dir_marks[left_of(dir)]);
+  print_long(dir_marks[flip(dir)]);
+  print_long(dir_marks[right_of(dir)]);
+  lcd_goto_xy(3, 1);
+  switch(dir)
+  {
+    case NORTH: print_character('N'); break;
+    case EAST:  print_character('E'); break;
+    case SOUTH: print_character('S'); break;
+    case WEST:  print_character('W'); break;
+  }
+  lcd_goto_xy(5, 0);
+  print_character('x');
+  print_long(here.x);
+  lcd_goto_xy(5, 1);
+  print_character('y');
+  print_long(here.y);*/
+  // the new segment can only lower costs, starting from its ends; the
+  // costs and path are brought up to date while driving the next segment
+  if (recorded_finish)
+  {
+    push_cost(prev.x, prev.y);
+    push_cost(here.x, here.y);
+    plan_in_background();
+  }
+
+  display_clear();
+  display_print_long(seg_length);
+  if (recorded_finish)
+  {
+    // best known route so far, in cells
+    display_goto(4, 0);
+    display_print_long(maze[start.x][start.y].cost);
+  }
+  //wait_for_button(BUTTON_A);
+  //delay(200);
+}  
+
+char select_turn()
+{  
+  if ((dir_marks[left_of(dir)] || dir_marks[dir] || dir_marks[right_of(dir)]) && dir_marks[flip(dir)] == 1)
+  {
+    // we've seen this intersection before, but we didn't depart in the direction we just arrived from, so we found a loop; turn around and go back
+    return 'B';
+  }
+  
+  unsigned char selected_turn = 'B';
+  uint8_t fewest_marks = 2;
+  
+  if (found_left && (dir_marks[left_of(dir)] < fewest_marks))
+  {
+    selected_turn = 'L';
+    fewest_marks = dir_marks[left_of(dir)];
+  }
+  if (found_straight && (dir_marks[dir] < fewest_marks))
+  {
+    selected_turn = 'S';
+    fewest_marks = dir_marks[dir];
+  }
+  if (found_right && (dir_marks[right_of(dir)] < fewest_marks))
+  {
+    selected_turn = 'R';
+    fewest_marks = dir_marks[right_of(dir)];
+  }  
+  
+  if ((fewest_marks == 2) && dir_marks[flip(dir)] >= 2)
+  {
+    // we've arrived back at the start
+    // there might be 3 marks in the direction we came from if we originally started in the middle of a segment:
+    //  ___________
+    // /   start___)
+    // \___________end
+    return 'X';
+  }    
+
+  // 
+  return selected_turn;
+}
+
+void add_path_segment(char turn_dir, uint16_t seg_length)
+{
+  if (seg_length > UINT8_MAX)
+    seg_length = UINT8_MAX;
+    
+  path[path_length] = turn_dir;
+  path_seg_lengths[path_length] = seg_length;
+  path_speeds[path_length] = 0;
+  path_length++;
+}
+
+void start_path()
+{
+  path_length = 0;
+  path_here = start;
+  path_dir = start_dir;
+  path_seg_length = 0;
+}
+
+// Walks the path one cell further.  Returns false once it has reached
+// the finish.
+bool build_path_step()
+{
+  if ((path_here.x == finish.x) && (path_here.y == finish.y))
+  {
+    add_path_segment('X', path_seg_length);
+    return false;
+  }
+  
+  if (maze[path_here.x][path_here.y].cost == MAX_COST || path_length >= MAX_PATH_LENGTH - 1)
+    return false; // no route known yet
+    
+  dir_to_finish_here = get_dir_to_finish(path_here.x, path_here.y);
+    
+  // only add 'S' if there's an intersection (left or right exit)
+  if ((dir_to_finish_here == path_dir) && (has_exit(path_here.x, path_here.y, left_of(path_dir)) || has_exit(path_here.x, path_here.y, right_of(path_dir))))
+  {
+    add_path_segment('S', path_seg_length);
+    path_seg_length = 0;
+  }
+  
+  if (dir_to_finish_here == left_of(path_dir))
+  {
+    add_path_segment('L', path_seg_length);
+    path_seg_length = 0;
+  }
+  
+  if (dir_to_finish_here == right_of(path_dir))
+  {
+    add_path_segment('R', path_seg_length);
+    path_seg_length = 0;
+  }
+  
+  if (dir_to_finish_here == flip(path_dir))
+  {
+    // this should only happen as the very first turn
+    add_path_segment('B', path_seg_length);
+    path_seg_length = 0;
+  }
+  
+  path_dir = dir_to_finish_here;
+  
+  switch (path_dir)
+  {
+  case NORTH:
+    path_seg_length += SEG_LENGTH_SCALE + get_north_trim(path_here.x, path_here.y);
+    path_here.y++;
+    break;
+  case EAST:
+    path_seg_length += SEG_LENGTH_SCALE + get_east_trim(path_here.x, path_here.y);
+    path_here.x++;
+    break;
+  case SOUTH:
+    path_here.y--;
+    path_seg_length += SEG_LENGTH_SCALE + get_north_trim(path_here.x, path_here.y);
+    break;
+  case WEST:
+    path_here.x--;
+    path_seg_length += SEG_LENGTH_SCALE + get_east_trim(path_here.x, path_here.y);
+    break;    
+  }
+  
+  return true;
+}
+
+void build_path()
+{
+  start_path();
+  while (build_path_step());
+}
+
+// A background task: spreads any queued cost changes, then rebuilds the
+// path from the new costs.
+bool plan_slice()
+{
+  if (cost_queue_length)
+  {
+    for (uint8_t i = 0; i < PLAN_SLICE && cost_queue_length; i++)
+      relax_next_cost();
+    return true;
+  }
+  
+  if (cost_queue_overflowed)
+  {
+    // push every cell again, as relax_costs() does, over the next slices
+    cost_queue_overflowed = false;
+    reseed_cell = 0;
+  }
+  
+  if (reseed_cell < MAZE_SIZE * MAZE_SIZE)
+  {
+    for (uint8_t i = 0; i < PLAN_SLICE && reseed_cell < MAZE_SIZE * MAZE_SIZE && cost_queue_length < COST_QUEUE_SIZE; i++, reseed_cell++)
+      push_cost(reseed_cell % MAZE_SIZE, reseed_cell / MAZE_SIZE);
+    return true;
+  }
+  
+  for (uint8_t i = 0; i < PLAN_SLICE; i++)
+  {
+    if (!build_path_step())
+      return false;
+  }
+  return true;
+}
+
+// Replans in the background after the map or its costs have changed.
+void plan_in_background()
+{
+  start_path();
+  run_in_background(plan_slice);
+}
+
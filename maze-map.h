@@ -0,0 +1,162 @@
+/*
+ * The map and the planner: the maze as mapped so far, the cost of each
+ * cell to the finish, and the path to the finish built from them.
+ * maze-solve.c drives the robot and tells the map where it went, and
+ * the host tools in tools/ share these definitions.
+ */
+
+#ifndef __maze_map_h
+#define __maze_map_h
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "follow-segment.h"
+#include "maze-config.h"
+
+/*
+    +y
+ -x    +x 
+    -y
+*/
+
+typedef struct node
+{
+  cost_t cost;
+  uint8_t marks;
+  uint8_t trims;
+} node;
+
+extern node maze[MAZE_SIZE][MAZE_SIZE]; // x, y
+
+
+// directions
+
+#define NORTH 0
+#define EAST  1
+#define SOUTH 2
+#define WEST  3
+
+#define flip(dir) (dir ^ 2)
+#define left_of(dir) ((dir - 1) & 0x3)
+#define right_of(dir) ((dir + 1) & 0x3)
+
+
+// exit info
+
+#define NORTH_LSB 0
+#define EAST_LSB 2
+#define DIR_TO_FINISH_LSB 4
+
+#define NORTH_MARK (1 << NORTH_LSB)
+#define EAST_MARK  (1 << EAST_LSB)
+
+#define NORTH_MARK_MASK (0x3 << NORTH_LSB)
+#define EAST_MARK_MASK  (0x3 << EAST_LSB)
+#define DIR_TO_FINISH_MASK  (0x3 << DIR_TO_FINISH_LSB)
+
+#define get_north_marks(x, y) ((maze[x][y].marks & NORTH_MARK_MASK) >> NORTH_LSB)
+#define get_east_marks(x, y)  ((maze[x][y].marks & EAST_MARK_MASK) >> EAST_LSB)
+#define add_north_mark(x, y) (maze[x][y].marks += NORTH_MARK)
+#define add_east_mark(x, y)  (maze[x][y].marks += EAST_MARK)
+
+#define get_dir_to_finish(x, y) ((maze[x][y].marks & DIR_TO_FINISH_MASK) >> DIR_TO_FINISH_LSB)
+#define set_dir_to_finish(x, y, dir) (maze[x][y].marks = ((maze[x][y].marks & ~DIR_TO_FINISH_MASK) | ((dir) << DIR_TO_FINISH_LSB)))
+
+// An exit that has been seen but never driven, such as a line taped down
+// after mapping.  It makes its node an intersection, which matters when
+// counting intersections, but planning only uses marked edges.
+#define NORTH_SEEN_LSB 6
+#define EAST_SEEN_LSB 7
+
+#define NORTH_SEEN (1 << NORTH_SEEN_LSB)
+#define EAST_SEEN  (1 << EAST_SEEN_LSB)
+
+// The same, for the edge leaving a node in any direction.  Edges are
+// stored on their south or west node, so a SOUTH or WEST edge lives on
+// the neighbouring node (see exit_node()).
+#define exit_mark(d)      (((d) & 1) ? EAST_MARK : NORTH_MARK)
+#define exit_mark_mask(d) (((d) & 1) ? EAST_MARK_MASK : NORTH_MARK_MASK)
+#define exit_seen(d)      (((d) & 1) ? EAST_SEEN : NORTH_SEEN)
+
+#define step_x(x, d) ((x) + ((d) == EAST) - ((d) == WEST))
+#define step_y(y, d) ((y) + ((d) == NORTH) - ((d) == SOUTH))
+
+#define has_mapped_exit(x, y, d) (exit_node(x, y, d)->marks & exit_mark_mask(d))
+#define has_exit(x, y, d) (exit_node(x, y, d)->marks & (exit_mark_mask(d) | exit_seen(d)))
+
+
+// measured length info
+
+// Segments are snapped to whole cells, which is what merges the ends of
+// two segments into one node when they are within half a cell of each
+// other.  The remainder of the measured length (in 1/SEG_LENGTH_SCALE
+// cell units, always within half a cell) is kept as a signed 4-bit trim
+// on one edge of the segment, so that summing cells and trims along a
+// segment gives back its measured length.
+
+#define NORTH_TRIM_LSB 0
+#define EAST_TRIM_LSB 4
+
+#define NORTH_TRIM_MASK (0xF << NORTH_TRIM_LSB)
+#define EAST_TRIM_MASK  (0xF << EAST_TRIM_LSB)
+
+#define get_north_trim(x, y) ((int8_t)(maze[x][y].trims << (4 - NORTH_TRIM_LSB)) >> 4)
+#define get_east_trim(x, y)  ((int8_t)(maze[x][y].trims << (4 - EAST_TRIM_LSB)) >> 4)
+#define set_north_trim(x, y, trim) (maze[x][y].trims = ((maze[x][y].trims & ~NORTH_TRIM_MASK) | (((trim) & 0xF) << NORTH_TRIM_LSB)))
+#define set_east_trim(x, y, trim)  (maze[x][y].trims = ((maze[x][y].trims & ~EAST_TRIM_MASK) | (((trim) & 0xF) << EAST_TRIM_LSB)))
+
+#define exit_trim_mask(d) (((d) & 1) ? EAST_TRIM_MASK : NORTH_TRIM_MASK)
+
+// state info
+
+typedef struct pos
+{
+  int8_t x;
+  int8_t y;
+} pos;
+
+#define distance_between(a, b) (abs((b).x - (a).x) + abs((b).y - (a).y)) // manhattan distance
+
+extern uint8_t dir;
+extern pos start, here, prev, finish;
+extern uint8_t start_dir; // the way the robot faces at the start: NORTH, except in lap mode
+extern bool recorded_finish;
+
+// the exits found where the robot stopped, and the marks on each exit
+// of here, for select_turn()
+extern bool found_left, found_straight, found_right;
+extern uint8_t dir_marks[4];
+
+
+// the path, a turn at each node with the length before it, for the runs,
+// profiles.c and map-link.c
+
+extern char path[];
+extern uint8_t path_seg_lengths[];
+extern uint8_t path_speeds[];
+extern uint8_t path_length;
+
+
+void clear_map();
+node *exit_node(int8_t x, int8_t y, uint8_t d);
+int8_t get_exit_trim(int8_t x, int8_t y, uint8_t d);
+void set_exit_trim(int8_t x, int8_t y, uint8_t d, int8_t trim);
+bool is_corridor(int8_t x, int8_t y, uint8_t d);
+bool forget_exit(int8_t x, int8_t y, uint8_t d);
+void see_exit(int8_t x, int8_t y, uint8_t d);
+void advance_to_next_node();
+void update_map(uint8_t seg_length, int8_t trim);
+char select_turn();
+
+void clear_costs();
+void fill_all_costs();
+void build_path();
+void plan_in_background();
+
+// The map in the serial format of map-format.h, for map-link.c.
+uint8_t get_map_edges(int8_t x, int8_t y);
+uint8_t get_map_trims(int8_t x, int8_t y);
+void get_map_ends(uint8_t *ends); // start x, y, finish x, y
+
+#endif
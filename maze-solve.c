@@ -5,92 +5,34 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <pololu/3pi.h>
+#include "calibrate.h"
+#include "display.h"
 #include "follow-segment.h"
+#include "maze-config.h"
+#include "map-format.h"
+#include "maze-map.h"
+#include "maze-solve.h"
+#include "motors.h"
+#include "params.h"
+#include "profiles.h"
+#include "beacon.h"
+#include "scheduler.h"
 #include "sounds.h"
+#include "turn-table.h"
 
-#define MAZE_SIZE 16
-#define MAX_COST 255
-
-/*
-    +y
- -x    +x 
-    -y
-*/
-
-typedef struct node
-{
-  uint8_t cost;
-  uint8_t marks;
-} node;
-
-node maze[MAZE_SIZE][MAZE_SIZE]; // x, y
-
-
-// directions
-
-#define NORTH 0
-#define EAST  1
-#define SOUTH 2
-#define WEST  3
-
-#define flip(dir) (dir ^ 2)
-#define left_of(dir) ((dir - 1) & 0x3)
-#define right_of(dir) ((dir + 1) & 0x3)
-
-
-// exit info
-
-#define NORTH_LSB 0
-#define EAST_LSB 2
-#define DIR_TO_FINISH_LSB 4
-
-#define NORTH_MARK (1 << NORTH_LSB)
-#define EAST_MARK  (1 << EAST_LSB)
-
-#define NORTH_MARK_MASK (0x3 << NORTH_LSB)
-#define EAST_MARK_MASK  (0x3 << EAST_LSB)
-#define DIR_TO_FINISH_MASK  (0x3 << DIR_TO_FINISH_LSB)
-
-#define get_north_marks(x, y) ((maze[x][y].marks & NORTH_MARK_MASK) >> NORTH_LSB)
-#define get_east_marks(x, y)  ((maze[x][y].marks & EAST_MARK_MASK) >> EAST_LSB)
-#define add_north_mark(x, y) (maze[x][y].marks += NORTH_MARK)
-#define add_east_mark(x, y)  (maze[x][y].marks += EAST_MARK)
-
-#define get_dir_to_finish(x, y) ((maze[x][y].marks & DIR_TO_FINISH_MASK) >> DIR_TO_FINISH_LSB)
-#define set_dir_to_finish(x, y, dir) (maze[x][y].marks = ((maze[x][y].marks & ~DIR_TO_FINISH_MASK) | ((dir) << DIR_TO_FINISH_LSB)))
+// navigate_to_finish() takes a segment measured within this of the
+// length the map has for it as ending where the map has it end
+#define SNAP_TOLERANCE (SEG_LENGTH_SCALE * 3 / 4)
 
 
 // state info
 
-typedef struct pos
-{
-  int8_t x;
-  int8_t y;
-} pos;
-
-#define distance_between(a, b) (abs((b).x - (a).x) + abs((b).y - (a).y)) // manhattan distance
-
-uint8_t dir;
-pos start, here, prev, finish;
-bool found_finish;
-bool recorded_finish;
-
-bool found_left, found_straight, found_right;
-uint8_t dir_marks[4];
-
-
-// used to pass info in fill_costs_from_node() recursion
-
-uint8_t cost_here, dir_to_finish_here;
-
-
-// final path
-
-#define MAX_PATH_LENGTH 100
+bool found_finish; // the last intersection identified was the finish
+unsigned int segment_ms; // time taken by the last follow_and_identify()
 
-char path[MAX_PATH_LENGTH];
-uint8_t path_seg_lengths[MAX_PATH_LENGTH];
-uint8_t path_length; // the length of the path
+// time to pull up onto an intersection after a known segment, in
+// place of follow_and_identify()'s 250 ms
+#define KNOWN_PULL_UP_MS 100
 
 
 // Displays the current path on the LCD, using two rows if necessary.
@@ -101,480 +43,476 @@ void display_path()
 
   for (i = 0; (i < path_length) && (i < 8); i++)
   {
-    buf[2*i] = '0' + path_seg_lengths[i];
+    buf[2*i] = '0' + (path_seg_lengths[i] + SEG_LENGTH_SCALE / 2) / SEG_LENGTH_SCALE;
     buf[2*i+1] = path[i];
   }
   buf[2*i] = 0;
   
-  clear();
-  print(buf);
+  display_clear();
+  display_print(buf);
 
   if(path_length > 4)
   {
-    lcd_goto_xy(0,1);
-    print(buf+8);
+    display_goto(0,1);
+    display_print(buf+8);
   }
 }
 
 
-void clear_map()
+void turn(char turn_dir)
 {
-  for (uint8_t y = 0; y < MAZE_SIZE; y++)
+  if (turn_dir != 'S')
+    beacon(BEACON_TURN_START);
+    
+  switch(turn_dir)
   {
-    for (uint8_t x = 0; x < MAZE_SIZE; x++)
-      maze[x][y] = (node){ .cost = MAX_COST, .marks = 0 };
+  case 'L':
+    // Turn left.
+    dir = left_of(dir);
+    drive_motors(-80,80);
+    background_delay_ms(200);
+    break;
+  case 'R':
+    // Turn right.
+    dir = right_of(dir);
+    drive_motors(80,-80);
+    background_delay_ms(200);
+    break;
+  case 'B':
+    // Turn around.
+    dir = flip(dir);
+    drive_motors(80,-80);
+    background_delay_ms(400);
+    break;
+  case 'S':
+    // Don't do anything!
+    return;
   }
+  
+  beacon(BEACON_TURN_END);
 }
 
-void shift_map_north(uint8_t amt)
+// Follows a segment, pulls up onto the intersection at its end and
+// checks which exits it has.  Returns the time taken, which includes the
+// pull-up.
+unsigned int follow_and_identify()
 {
-  for (int8_t y = (MAZE_SIZE - 1); y >= 0; y--) 
+  found_left = found_straight = found_right = found_finish = false;
+  
+  unsigned int start_ms = get_ms();
+  
+  follow_segment();
+
+  // Drive straight a bit.  This helps us in case we entered the
+  // intersection at an angle.
+  // Note that we are slowing down - this prevents the robot
+  // from tipping forward too much.
+  drive_motors(50,50);
+  background_delay_ms(50);
+
+  // Now read the sensors and check the intersection type.
+  unsigned int sensors[5];
+  read_line(sensors,IR_EMITTERS_ON);
+
+  // Check for left and right exits.
+  if(sensors[0] > params[PARAM_SIDE])
+    found_left = true;
+  if(sensors[4] > params[PARAM_SIDE])
+    found_right = true;
+
+  // Drive straight a bit more - this is enough to line up our
+  // wheels with the intersection.
+  drive_motors(40,40);
+  background_delay_ms(200);
+  
+  unsigned int end_ms = get_ms();
+
+  // Check for a straight exit.
+  read_line(sensors,IR_EMITTERS_ON);
+  if(sensors[1] > params[PARAM_LINE] || sensors[2] > params[PARAM_LINE] || sensors[3] > params[PARAM_LINE])
+    found_straight = true;
+
+  // Check for the ending spot.
+  // If all three middle sensors are on dark black, we have
+  // solved the maze.
+  if(sensors[1] > params[PARAM_FINISH] && sensors[2] > params[PARAM_FINISH] && sensors[3] > params[PARAM_FINISH])
   {
-    for (int8_t x = 0; x < MAZE_SIZE; x++)
-    {
-      if (y >= amt)
-        maze[x][y].marks = maze[x][y - amt].marks;
-      else
-        maze[x][y].marks = 0;
-    }
+    found_left = found_straight = found_right = false;
+    found_finish = true;
   }
   
-  start.y  += amt;
-  here.y   += amt;
-  prev.y   += amt;
-  finish.y += amt;
+  segment_ms = end_ms - start_ms;
+  return segment_ms;
 }
 
-void shift_map_east(uint8_t amt)
+// empirically determined: length = (ms - 65) / 709, see PARAM_SEG_MS
+// and PARAM_CELL_MS
+// Returns the length in 1/SEG_LENGTH_SCALE cells.
+uint16_t ms_to_length(unsigned int ms)
 {
-  for (int8_t x = (MAZE_SIZE - 1); x >= 0; x--)
-  {
-    for (int8_t y = 0; y < MAZE_SIZE; y++)
-    {
-      if (x >= amt)
-        maze[x][y].marks = maze[x - amt][y].marks;
-      else
-        maze[x][y].marks = 0;
-    }
-  }
-  
-   start.x  += amt;
-   here.x   += amt;
-   prev.x   += amt;
-   finish.x += amt;
+  return ((unsigned long)(ms - params[PARAM_SEG_MS]) * SEG_LENGTH_SCALE + params[PARAM_CELL_MS] / 2) / params[PARAM_CELL_MS];
 }
 
-void shift_map_south(uint8_t amt)
+// The fast follower drove past the intersection at here without
+// seeing it and stopped at the next one, or where the line ends.  Turns
+// round and comes back to it at mapping speed, leaving the robot on it
+// facing the way it came.
+void back_to_missed_node()
 {
-  for (int8_t y = 0; y < MAZE_SIZE; y++)
-  {
-    for (int8_t x = 0; x < MAZE_SIZE; x++)
-    {
-      if (y < (MAZE_SIZE - amt))
-        maze[x][y].marks = maze[x][y + amt].marks;
-      else
-        maze[x][y].marks = 0;
-    }
-  }
-  
-  start.y  -= amt;
-  here.y   -= amt;
-  prev.y   -= amt;
-  finish.y -= amt;
+  drive_motors(0, 0);
+  play_from_program_space(detour_sound);
+  turn('B');
+  follow_and_identify();
 }
 
-void shift_map_west(uint8_t amt)
+// The turn that leaves an intersection the way turn_dir would, for a
+// robot facing back the way it came.
+char turn_from_behind(char turn_dir)
 {
-  for (int8_t x = 0; x < MAZE_SIZE; x++)
+  switch (turn_dir)
   {
-    for (int8_t y = 0; y < MAZE_SIZE; y++)
-    {
-      if (x < (MAZE_SIZE - amt))
-        maze[x][y].marks = maze[x + amt][y].marks;
-      else
-        maze[x][y].marks = 0;
-    }
+  case 'L':
+    return 'R';
+  case 'R':
+    return 'L';
+  case 'S':
+    return 'B';
+  default:
+    return 'S';
   }
-  
-  start.x  -= amt;
-  here.x   -= amt;
-  prev.x   -= amt;
-  finish.x -= amt;
 }
 
-void update_map(uint8_t seg_length)
+// Where the map has the segment ahead of here ending: sets *end to the
+// next node the followers would stop at and returns the segment's length
+// in 1/SEG_LENGTH_SCALE cells, or 0 if the map has no line ahead.
+uint16_t predicted_segment(pos *end)
 {
-  prev = here;
+  pos p = here;
+  uint16_t length = 0;
   
-  // record the most recent segment followed
-  
-  switch(dir)
-  {
+  if (!has_mapped_exit(here.x, here.y, dir))
+    return 0;
     
-  case NORTH:
-    here.y += seg_length;
-
-    if (here.y >= MAZE_SIZE)
-      shift_map_south(here.y - (MAZE_SIZE - 1));
-      
-    for (uint8_t y = prev.y; y < here.y; y++)
-      add_north_mark(here.x, y);
- 
-    break;  
-
-
-  case EAST:
+  do
+  {
+    length += SEG_LENGTH_SCALE + get_exit_trim(p.x, p.y, dir);
+    p.x = step_x(p.x, dir);
+    p.y = step_y(p.y, dir);
+  } while (is_corridor(p.x, p.y, dir));
   
-    here.x += seg_length;
-      
-    if (here.x >= MAZE_SIZE)
-      shift_map_west(here.x - (MAZE_SIZE - 1));
-      
-    for (uint8_t x = prev.x; x < here.x; x++)
-      add_east_mark(x, here.y);
-
-    break;
-
+  *end = p;
+  return length;
+}
 
-  case SOUTH:
+// Looks along the map for a segment ahead that has been driven before
+// and ends at an intersection whose exits are all on the map.  Returns
+// its length in 1/SEG_LENGTH_SCALE cells and sets *end, or 0 if the
+// segment must be followed and identified as usual.  Dead ends and the
+// finish are left to follow_and_identify(), since the fast follower
+// doesn't stop on them where mapping expects to.
+uint16_t known_segment(pos *end)
+{
+  pos p;
+  uint16_t length = predicted_segment(&p);
   
-    here.y -= seg_length;
-      
-    if (here.y < 1)
-      shift_map_north(1 - here.y);  
-
-    for (uint8_t y = here.y; y < prev.y; y++)
-      add_north_mark(here.x, y);
-        
-    break;
-    
-    
-  case WEST:
+  if (!length)
+    return 0;
+  if (!has_exit(p.x, p.y, left_of(dir)) && !has_exit(p.x, p.y, right_of(dir)))
+    return 0;
+  if (recorded_finish && (p.x == finish.x) && (p.y == finish.y))
+    return 0;
   
-    here.x -= seg_length;
-      
-    if (here.x < 1)
-      shift_map_east(1 - here.x);
-      
-    for (uint8_t x = here.x; x < prev.x; x++)
-      add_east_mark(x, here.y);
+  *end = p;
+  return length;
+}
 
-    break;
-  }   
-    
-      
-  // store # of marks in each direction
-  dir_marks[NORTH] = get_north_marks(here.x, here.y);
-  dir_marks[EAST]  = get_east_marks(here.x, here.y);
-  dir_marks[SOUTH] = get_north_marks(here.x, here.y - 1);
-  dir_marks[WEST]  = get_east_marks(here.x - 1, here.y);
-  
-  
-  /*set_motors(0, 0);
-  clear();
-  lcd_goto_xy(1, 0);
-  print_long(dir_marks[dir]);
-  lcd_goto_xy(0, 1);
-  print_long(dir_marks[left_of(dir)]);
-  print_long(dir_marks[flip(dir)]);
-  print_long(dir_marks[right_of(dir)]);
-  lcd_goto_xy(3, 1);
-  switch(dir)
-  {
-    case NORTH: print_character('N'); break;
-    case EAST:  print_character('E'); break;
-    case SOUTH: print_character('S'); break;
-    case WEST:  print_character('W'); break;
-  }
-  lcd_goto_xy(5, 0);
-  print_character('x');
-  print_long(here.x);
-  lcd_goto_xy(5, 1);
-  print_character('y');
-  print_long(here.y);*/
-  clear();
-  print_long(seg_length);
-  //wait_for_button(BUTTON_A);
-  //delay(200);
-}  
-
-char select_turn()
-{  
-  if ((dir_marks[left_of(dir)] || dir_marks[dir] || dir_marks[right_of(dir)]) && dir_marks[flip(dir)] == 1)
-  {
-    // we've seen this intersection before, but we didn't depart in the direction we just arrived from, so we found a loop; turn around and go back
-    return 'B';
-  }
+// Drives a segment known_segment() found at the aggressive run's speed,
+// braking for its known length, and takes the exits at its end from the
+// map instead of stopping to look.  Like the fast runs, this trusts the
+// map; mapping assumes the maze holds still.  Returns the length as
+// map_maze() measures it, with the trim update_map() already has, so
+// the map is marked but its lengths are left alone.
+uint16_t follow_known_segment(uint16_t length, pos end)
+{
+  unsigned int start_ms = get_ms();
   
-  unsigned char selected_turn = 'B';
-  uint8_t fewest_marks = 2;
+  follow_segment_aggressive(length, NULL, 0, 255);
   
-  if (found_left && (dir_marks[left_of(dir)] < fewest_marks))
+  if (overshot)
   {
-    selected_turn = 'L';
-    fewest_marks = dir_marks[left_of(dir)];
+    back_to_missed_node();
+    turn('B');
   }
-  if (found_straight && (dir_marks[dir] < fewest_marks))
+  else
   {
-    selected_turn = 'S';
-    fewest_marks = dir_marks[dir];
+    // The fast follower stops as soon as it sees the intersection, so
+    // pull up onto it as follow_and_identify() does, but for less time
+    // since we arrive faster.
+    drive_motors(40,40);
+    background_delay_ms(KNOWN_PULL_UP_MS);
   }
-  if (found_right && (dir_marks[right_of(dir)] < fewest_marks))
-  {
-    selected_turn = 'R';
-    fewest_marks = dir_marks[right_of(dir)];
-  }  
+  segment_ms = get_ms() - start_ms;
   
-  if ((fewest_marks == 2) && dir_marks[flip(dir)] >= 2)
-  {
-    // we've arrived back at the start
-    // there might be 3 marks in the direction we came from if we originally started in the middle of a segment:
-    //  ___________
-    // /   start___)
-    // \___________end
-    return 'X';
-  }    
-
-  // 
-  return selected_turn;
+  found_left = has_exit(end.x, end.y, left_of(dir));
+  found_straight = has_exit(end.x, end.y, dir);
+  found_right = has_exit(end.x, end.y, right_of(dir));
+  found_finish = false;
+  
+  // update_map() keeps the trim on the segment's south or west edge
+  int8_t trim;
+  if (dir == NORTH || dir == EAST)
+    trim = get_exit_trim(here.x, here.y, dir);
+  else
+    trim = get_exit_trim(end.x, end.y, flip(dir));
+  return distance_between(here, end) * SEG_LENGTH_SCALE + trim;
 }
 
-void turn(char turn_dir)
+bool drive_path_aggressive(bool brake_at_end, bool end_at_dead_end); // with the fast runs, below
+uint8_t count_exits(int8_t x, int8_t y);
+
+// The exits found at the end of the last segment, for the fingerprint.
+uint8_t fingerprint_exits_found()
 {
-  switch(turn_dir)
-  {
-  case 'L':
-    // Turn left.
-    dir = left_of(dir);
-    set_motors(-80,80);
-    delay_ms(200);
-    break;
-  case 'R':
-    // Turn right.
-    dir = right_of(dir);
-    set_motors(80,-80);
-    delay_ms(200);
-    break;
-  case 'B':
-    // Turn around.
-    dir = flip(dir);
-    set_motors(80,-80);
-    delay_ms(400);
-    break;
-  case 'S':
-    // Don't do anything!
-    break;
-  }
+  return (found_left ? FINGERPRINT_LEFT : 0) | (found_straight ? FINGERPRINT_STRAIGHT : 0) |
+         (found_right ? FINGERPRINT_RIGHT : 0) | (found_finish ? FINGERPRINT_FINISH : 0);
 }
 
-// using global vars instead of function params to keep track of stuff should cut down on RAM usage at the cost of slower execution
-void fill_costs_from_here()
+// True if every line mapped so far is on the stored map of slot, with
+// the map shifted by (dx, dy).
+bool matches_profile(uint8_t slot, int8_t dx, int8_t dy)
 {
-  if (cost_here < maze[here.x][here.y].cost)
+  for (int8_t y = 0; y < MAZE_SIZE; y++)
   {
-     maze[here.x][here.y].cost = cost_here;
-    set_dir_to_finish(here.x, here.y, dir_to_finish_here);
-    
-    if ((distance_between(start, here) + cost_here) < maze[start.x][start.y].cost)
+    for (int8_t x = 0; x < MAZE_SIZE; x++)
     {
-      cost_here++;
-      
-      if (get_north_marks(here.x, here.y) )
-      {
-        // north exit
-        dir_to_finish_here = SOUTH;
-        here.y++;
-        fill_costs_from_here();
-        here.y--;
-      }      
-      if (get_east_marks(here.x, here.y))
-      {
-        // east exit
-        dir_to_finish_here = WEST;
-        here.x++;
-        fill_costs_from_here();
-        here.x--;
-      }      
-      if (get_north_marks(here.x, here.y - 1))
-      {
-        // south exit
-        dir_to_finish_here = NORTH;
-        here.y--;
-        fill_costs_from_here();
-        here.y++;
-      }      
-      if (get_east_marks(here.x - 1, here.y))
-      {
-        // west exit
-        dir_to_finish_here = EAST;
-        here.x--;
-        fill_costs_from_here();
-        here.x++;
-      }
-      
-      cost_here--;
+      uint8_t edges = get_map_edges(x, y) & (MAP_NORTH_EDGE | MAP_EAST_EDGE);
+      if (!edges)
+        continue;
+      int8_t px = x + dx, py = y + dy;
+      if (px < 0 || py < 0 || px >= MAZE_SIZE || py >= MAZE_SIZE ||
+          (get_profile_edges(slot, px, py) & edges) != edges)
+        return false;
     }
-  }    
+  }
+  return true;
 }
 
-void fill_all_costs()
+// True if the start stored in slot is somewhere the robot stops by
+// itself, as is_stop() would say on the stored map, so that it can tell
+// when it gets back there.
+bool profile_start_is_stop(uint8_t slot, int8_t x, int8_t y)
 {
-  cost_here = 0;
-  here = finish;
+  bool north = get_profile_edges(slot, x, y) & MAP_NORTH_EDGE;
+  bool east = get_profile_edges(slot, x, y) & MAP_EAST_EDGE;
+  bool south = y > 0 && (get_profile_edges(slot, x, y - 1) & MAP_NORTH_EDGE);
+  bool west = x > 0 && (get_profile_edges(slot, x - 1, y) & MAP_EAST_EDGE);
   
-  fill_costs_from_here(); // dir_to_finish is meaningless for finish node
+  return !(north && south && !east && !west) && !(east && west && !north && !south);
 }
 
-void add_path_segment(char turn_dir, uint8_t seg_length)
+// Puts the lengths measured along the path back on the map as trims,
+// where update_map() would keep them, so that build_path() gets them
+// back.  Stored maps have no trims of their own.
+void restore_trims()
 {
-  path[path_length] = turn_dir;
-  path_seg_lengths[path_length] = seg_length;
-  path_length++;
-}
-
-void build_path()
-{
-  prev = start;
-  here = start;
-  dir = NORTH;
+  pos p = start;
+  uint8_t d = start_dir;
   
-  while ( !((here.x == finish.x) && (here.y == finish.y)) )
+  for (uint8_t i = 0; i < path_length; i++)
   {
-    dir_to_finish_here = get_dir_to_finish(here.x, here.y);
-    dir_marks[NORTH] = get_north_marks(here.x, here.y);
-    dir_marks[EAST]  = get_east_marks(here.x, here.y);
-    dir_marks[SOUTH] = get_north_marks(here.x, here.y - 1);
-    dir_marks[WEST]  = get_east_marks(here.x - 1, here.y);
-      
-    // only add 'S' if there's an intersection (left or right exit)
-    if ((dir_to_finish_here == dir) && (dir_marks[left_of(dir)] || dir_marks[right_of(dir)]))
+    if (path_seg_lengths[i])
     {
-      add_path_segment('S', distance_between(prev, here));
-      prev = here;
-    }
-    
-    if (dir_to_finish_here == left_of(dir))
-    {
-      add_path_segment('L', distance_between(prev, here));
-      prev = here;
+      pos from = p;
+      uint8_t cells = 0;
+      do
+      {
+        p.x = step_x(p.x, d);
+        p.y = step_y(p.y, d);
+        cells++;
+      } while (is_corridor(p.x, p.y, d) && cells < MAZE_SIZE);
+      
+      int16_t trim = path_seg_lengths[i] - cells * SEG_LENGTH_SCALE;
+      if (trim > 7)
+        trim = 7;
+      if (trim < -8)
+        trim = -8;
+      if (d == NORTH || d == EAST)
+        set_exit_trim(from.x, from.y, d, trim);
+      else
+        set_exit_trim(p.x, p.y, flip(d), trim);
     }
     
-    if (dir_to_finish_here == right_of(dir))
+    switch (path[i])
     {
-      add_path_segment('R', distance_between(prev, here));
-      prev = here;
+    case 'L':
+      d = left_of(d);
+      break;
+    case 'R':
+      d = right_of(d);
+      break;
+    case 'B':
+      d = flip(d);
+      break;
     }
+  }
+}
+
+// Once mapping has noted its fingerprint, looks for a stored maze that
+// matches it and has every line driven so far.  If there is one, it
+// takes the place of the map and path, with here moved onto it, and
+// its slot is returned; otherwise -1.
+int8_t recall_profile()
+{
+  for (uint8_t slot = 0; slot < PROFILE_COUNT; slot++)
+  {
+    if (!fingerprint_matches(slot))
+      continue;
     
-    if (dir_to_finish_here == flip(dir))
-    {
-      // this should only happen as the very first turn
-      add_path_segment('B', distance_between(prev, here));
-      prev = here;
-    }
+    uint8_t ends[4];
+    get_profile_ends(slot, ends);
+    int8_t dx = ends[0] - start.x, dy = ends[1] - start.y;
+    if (!matches_profile(slot, dx, dy) || !profile_start_is_stop(slot, ends[0], ends[1]))
+      continue;
     
-    dir = dir_to_finish_here;
+    // planning in progress refers to the map about to go
+    finish_background();
+    if (!load_profile_path(slot))
+      continue;
     
-    switch (dir)
+    for (int8_t y = 0; y < MAZE_SIZE; y++)
     {
-    case NORTH:
-      here.y++;
-      break;
-    case EAST:
-      here.x++;
-      break;
-    case SOUTH:
-      here.y--;
-      break;
-    case WEST:
-      here.x--;
-      break;    
+      for (int8_t x = 0; x < MAZE_SIZE; x++)
+      {
+        uint8_t edges = get_profile_edges(slot, x, y);
+        maze[x][y] = (node){ .cost = MAX_COST,
+                             .marks = ((edges & MAP_NORTH_EDGE) ? 2 * NORTH_MARK : 0) | ((edges & MAP_EAST_EDGE) ? 2 * EAST_MARK : 0),
+                             .trims = 0 };
+      }
     }
+    start = (pos){ ends[0], ends[1] };
+    finish = (pos){ ends[2], ends[3] };
+    here.x += dx;
+    here.y += dy;
+    recorded_finish = true;
+    start_dir = NORTH;
+    restore_trims();
+    fill_all_costs();
+    return slot;
   }
+  return -1;
+}
+
+// Drives back to the start of a recalled maze, planning from wherever
+// mapping got to as lap mode does, and faces north as mapping would
+// leave the robot.  The stored path is put back afterwards.  Returns
+// false if the robot didn't get there.
+bool return_to_start(uint8_t slot)
+{
+  pos home = start, away = finish;
+  bool arrived = true;
   
-  add_path_segment('X', distance_between(prev, here));
+  if (here.x != home.x || here.y != home.y)
+  {
+    start = here;
+    start_dir = dir;
+    finish = home;
+    fill_all_costs();
+    build_path();
+    arrived = path_length && path[path_length - 1] == 'X' &&
+      drive_path_aggressive(true, count_exits(home.x, home.y) == 1);
+    
+    start = home;
+    start_dir = NORTH;
+    finish = away;
+    fill_all_costs();
+    if (!load_profile_path(slot))
+      build_path();
+  }
+  
+  if (arrived)
+  {
+    if (dir == SOUTH)
+      turn('B');
+    else if (dir == EAST)
+      turn('L');
+    else if (dir == WEST)
+      turn('R');
+  }
+  return arrived;
 }
 
 // This function is called once, from main.c.
 void map_maze()
 {
+  uint8_t segments = 0;
+  int8_t slot = -1;
+  
   found_finish = recorded_finish = false;
-  dir = NORTH;
+  dir = start_dir = NORTH;
   start = (pos){ MAZE_SIZE / 2, MAZE_SIZE / 2 };
   here = start;
   
   clear_map();
   
-  set_digital_output(IO_D0, LOW);
+  beacon_run_start();
   
   // Loop until we have solved the maze.
   while(1)
   {
-    found_left = found_straight = found_right = false;
-    
-    unsigned int start_ms = get_ms();
-    
-    follow_segment();
-
-    // Drive straight a bit.  This helps us in case we entered the
-    // intersection at an angle.
-    // Note that we are slowing down - this prevents the robot
-    // from tipping forward too much.
-    set_motors(50,50);
-    delay_ms(50);
-
-    // Now read the sensors and check the intersection type.
-    unsigned int sensors[5];
-    read_line(sensors,IR_EMITTERS_ON);
-
-    // Check for left and right exits.
-    if(sensors[0] > 100)
-      found_left = true;
-    if(sensors[4] > 100)
-      found_right = true;
-
-    // Drive straight a bit more - this is enough to line up our
-    // wheels with the intersection.
-    set_motors(40,40);
-    delay_ms(200);
-    
-    unsigned int end_ms = get_ms();
-
-    // Check for a straight exit.
-    read_line(sensors,IR_EMITTERS_ON);
-    if(sensors[1] > 200 || sensors[2] > 200 || sensors[3] > 200)
-      found_straight = true;
-
-    // Check for the ending spot.
-    // If all three middle sensors are on dark black, we have
-    // solved the maze.
-    if(sensors[1] > 600 && sensors[2] > 600 && sensors[3] > 600)
-    {
-      found_left = found_straight = found_right = false;
-      found_finish = true;
+    // Backtracking mostly drives over known ground, so that is done at
+    // speed.
+    pos end;
+    uint16_t measured_length = known_segment(&end);
+    if (measured_length)
+      measured_length = follow_known_segment(measured_length, end);
+    else
+      measured_length = ms_to_length(follow_and_identify());
+    uint8_t seg_length = (measured_length + SEG_LENGTH_SCALE / 2) / SEG_LENGTH_SCALE;
+
+    if (found_finish)
       play_from_program_space(done_sound);
-    }
     else if (!is_playing())
-    {
       play_from_program_space(map_turn_sound);
-    }
     
-    // Intersection identification is complete.
+    // Snap to whole cells for the grid and keep the remainder as the
+    // segment's trim.
+    update_map(seg_length, measured_length - seg_length * SEG_LENGTH_SCALE);
     
-    // stop motors to prevent too much untracked movement during the following computations (if they take too long)
-    // might not be necessary...
-    //set_motors(0, 0);
+    // Remember the exits found here, so that known_segment() can drive
+    // back to this node without stopping to look.
+    if (found_left)
+      see_exit(here.x, here.y, left_of(dir));
+    if (found_straight)
+      see_exit(here.x, here.y, dir);
+    if (found_right)
+      see_exit(here.x, here.y, right_of(dir));
     
-    // empirically determined: length = (ms - 65) / 709
-    uint8_t seg_length = (((end_ms - start_ms) - 65) + 354) / 709;
+    display_goto(0, 1);
+    display_print_long(segment_ms);
 
-    update_map(seg_length);
-    lcd_goto_xy(0, 1);
-    print_long(end_ms - start_ms);
+    // A maze mapped before is recognised from how mapping sets off in
+    // it, and run from the stored map rather than mapped again.
+    if (segments < FINGERPRINT_LENGTH)
+    {
+      note_fingerprint(segments++, measured_length, fingerprint_exits_found());
+      if (segments == FINGERPRINT_LENGTH && (slot = recall_profile()) >= 0)
+      {
+        play("!>>c16e16g16");
+        // mapping is over; the drive back is a run of its own
+        drive_motors(0, 0);
+        beacon_run_finish();
+        if (!return_to_start(slot))
+          return;
+        break;
+      }
+    }
 
     if (found_finish && !recorded_finish)
     {
       finish = here;
       recorded_finish = true;
+      clear_costs();
+      plan_in_background();
     }
     
     char turn_dir = select_turn();
@@ -592,81 +530,385 @@ void map_maze()
 
   // Solved the maze!
   
-  set_motors(0, 0);
-  set_digital_input(IO_D0, PULL_UP_ENABLED);
-  fill_all_costs();
-  build_path();  
+  drive_motors(0, 0);
+  if (slot < 0)
+    beacon_run_finish();
+  finish_background(); // the path was planned on the way back
+  if (slot < 0 && segments == FINGERPRINT_LENGTH)
+    save_profile();
+  save_adapted_calibration();
   display_path();
+  display_flush(DISPLAY_CHARS); // we're stopped, so just write it all
 }
 
-void run_maze_conservative()
+// Compares the exit in direction d of the node the robot has just
+// identified with the map.  An exit that isn't on the map is recorded as
+// seen, and one that isn't there any more is forgotten.  Returns true if
+// the costs need refilling.
+bool check_exit(uint8_t d, bool found)
 {
-  // Re-run the maze.  It's not necessary to identify the
-  // intersections, so this loop is really simple.
-  for(uint8_t i = 0; i < (path_length - 1); i++) // path ends with 'X'
+  if (!found)
+    return forget_exit(here.x, here.y, d);
+  
+  see_exit(here.x, here.y, d);
+  return false;
+}
+
+// Drives to the finish along the map's costs, starting on the node
+// "here" facing "dir" and stopping at every intersection like
+// map_maze().  Each stop is checked against the map: a dead end where
+// the map has a line, an intersection where it has none, or a missing or
+// extra exit is written into the map and the costs refilled, so a small
+// change to the maze costs a detour rather than a remap.  A measured
+// length within SNAP_TOLERANCE of the node the map predicts is taken as
+// reaching that node, so timing jitter can't move marks onto the wrong
+// cell; the cells are only walked and the map edited when it isn't.
+// Returns with found_finish set if the finish was reached.
+void navigate_to_finish()
+{
+  uint8_t stops = 0;
+  
+  found_finish = false;
+  
+  while (1)
   {
-    if (path_seg_lengths[i] > 0)
+    if (maze[here.x][here.y].cost == MAX_COST || maze[here.x][here.y].cost == 0 || ++stops == 0)
+    {
+      // the finish can't be reached any more, or isn't where we left it
+      drive_motors(0, 0);
+      play("!<c4<c4");
+      return;
+    }
+    
+    uint8_t new_dir = get_dir_to_finish(here.x, here.y);
+    char turn_dir = 'B';
+    if (new_dir == dir)
+      turn_dir = 'S';
+    else if (new_dir == left_of(dir))
+      turn_dir = 'L';
+    else if (new_dir == right_of(dir))
+      turn_dir = 'R';
+    
+    if (turn_dir != 'S')
+      play_from_program_space(run_turn_sound);
+    turn(turn_dir);
+    
+    pos predicted_end;
+    uint16_t predicted = predicted_segment(&predicted_end);
+    uint16_t measured = ms_to_length(follow_and_identify());
+    uint8_t seg_length = (measured + SEG_LENGTH_SCALE / 2) / SEG_LENGTH_SCALE;
+    bool changed = false;
+    
+    // Find where we are on the map.  We left a node, so we have gone at
+    // least one cell.
+    if (seg_length == 0)
+      seg_length = 1;
+    
+    if (predicted && abs((int)measured - (int)predicted) <= SNAP_TOLERANCE)
+    {
+      here = predicted_end;
+      seg_length = 0;
+    }
+      
+    for (; seg_length; seg_length--)
+    {
+      int8_t x = step_x(here.x, dir), y = step_y(here.y, dir);
+      
+      if (x < 1 || x >= MAZE_SIZE - 1 || y < 1 || y >= MAZE_SIZE - 1)
+        break; // keep the margin map_maze() keeps
+        
+      if (!has_mapped_exit(here.x, here.y, dir))
+      {
+        // the line goes on further than the map has it
+        exit_node(here.x, here.y, dir)->marks |= exit_mark(dir);
+        exit_node(here.x, here.y, dir)->marks &= ~exit_seen(dir);
+        changed = true;
+      }
+      
+      here.x = x;
+      here.y = y;
+      
+      if (seg_length > 1)
+      {
+        // if this was a node, we drove through it without stopping, so
+        // its side exits are gone
+        changed |= forget_exit(here.x, here.y, left_of(dir));
+        changed |= forget_exit(here.x, here.y, right_of(dir));
+      }
+    }
+    
+    if (found_finish)
+    {
+      if ((here.x != finish.x) || (here.y != finish.y))
+      {
+        // the finish has moved; keep the map right for the next run
+        finish = here;
+        fill_all_costs();
+      }
+      return;
+    }
+    
+    changed |= check_exit(left_of(dir), found_left);
+    changed |= check_exit(dir, found_straight);
+    changed |= check_exit(right_of(dir), found_right);
+    
+    if (changed)
     {
-      follow_segment();
+      play_from_program_space(detour_sound);
+      fill_all_costs();
+    }
+  }
+}
 
-      // Drive straight while slowing down, as before.
-      set_motors(50,50);
-      delay_ms(50);
-      set_motors(40,40);
-      delay_ms(200);
-    }      
+// Stops at the end of a run and plans the next one from the map, which
+// may have changed along the way.  That goes for a host plan too, even
+// if the finish wasn't reached.
+void finish_run()
+{
+  drive_motors(0, 0);
+  beacon_run_finish();
+  build_path();
+  
+  if (found_finish)
+  {
+    play_from_program_space(done_sound);
+    save_adapted_calibration();
+  }
+}
 
-    // Make a turn according to the instruction stored in
-    // path[i].
-    if (path[i] != 'S')
-      play_from_program_space(run_turn_sound);
-    turn(path[i]);
+// The fast runs can't tell where they hit a dead end, only how many of
+// the intersections they were told to ignore they had passed.  Go back
+// to the last of those, measuring how far we went beyond it, take the
+// rest of the line off the map and carry on as the conservative run
+// does.  If the line ended right at that intersection, we are still on
+// it and there is nothing to go back over.
+void recover_from_dead_end(uint8_t intersections_seen)
+{
+  drive_motors(0, 0);
+  play_from_program_space(detour_sound);
+  
+  while (intersections_seen--)
+    advance_to_next_node();
+  
+  if ((unsigned int)(get_ms() - last_node_ms) < 100)
+  {
+    // Lost straight after the node, most likely the turn onto the line
+    // carrying us off it.  The map has a line here, so look for it and
+    // only take it off the map if it really isn't there.
+    if (!find_line(0))
+      forget_exit(here.x, here.y, dir);
   }
+  else
+  {
+    uint8_t out_dir = dir;
     
-  // Follow the last segment up to the finish.
-  follow_segment();
-  set_motors(40,40);
+    turn('B');
+    uint8_t stub_length = (ms_to_length(follow_and_identify()) + SEG_LENGTH_SCALE / 2) / SEG_LENGTH_SCALE;
+    
+    // the line is still there for stub_length cells past this node
+    int8_t x = here.x, y = here.y;
+    for (; stub_length && has_mapped_exit(x, y, out_dir); stub_length--)
+    {
+      x = step_x(x, out_dir);
+      y = step_y(y, out_dir);
+    }
+    forget_exit(x, y, out_dir);
+    
+    check_exit(left_of(dir), found_left);
+    check_exit(dir, found_straight);
+    check_exit(right_of(dir), found_right);
+  }
+  
+  fill_all_costs();
+  navigate_to_finish();
+  finish_run();
+}
+
+void run_maze_conservative()
+{
+  // Re-run the maze by following the map rather than replaying the
+  // path, so that changes to the maze can be spotted and driven around.
+  here = start;
+  dir = NORTH;
+  
+  beacon_run_start();
+  navigate_to_finish();
+  finish_run();
+
+  // Now we should be at the finish!
+}
+
+// Turns from a moving start, as soon as the intersection is seen, and
+// keeps turning until the middle sensor finds the new line.  Stopping on
+// the line rather than after a fixed time makes up for entering the
+// turn at a slightly different speed or position each time.
+void turn_continuous(char turn_dir)
+{
+  unsigned int sensors[5];
+  unsigned int begin_ms = get_ms();
+  
+  if (turn_dir != 'S')
+    beacon(BEACON_TURN_START);
+    
+  switch(turn_dir)
+  {
+  case 'L':
+    dir = left_of(dir);
+    drive_motors(-20,80);
+    break;
+  case 'R':
+    dir = right_of(dir);
+    drive_motors(80,-20);
+    break;
+  case 'B':
+    dir = flip(dir);
+    drive_motors(80,-80);
+    break;
+  default:
+    // 'S': don't do anything!
+    return;
+  }
+  
+  // Turn far enough to leave the line we came in on before looking for
+  // the new one.
+  background_delay_ms(turn_dir == 'B' ? 200 : 100);
+  
+  do
+    read_line(sensors,IR_EMITTERS_ON);
+  while(sensors[2] < 500 && (unsigned int)(get_ms() - begin_ms) < 800);
+  
+  beacon(BEACON_TURN_END);
+}
+
+// Runs the path at follow_segment()'s speed without stopping: 'S'
+// intersections are counted and driven through, and turns begin as
+// soon as their intersection is seen.
+void run_maze_continuous()
+{
+  uint8_t intersections_to_ignore = 0;
+  uint8_t intersections_seen;
+  
+  here = start;
+  dir = NORTH;
+  beacon_run_start();
+  
+  for(uint8_t i = 0; i < (path_length - 1); i++) // path ends with 'X'
+  {
+    if (path_seg_lengths[i] > 0)
+    {
+      if (path[i] == 'S')
+      {
+        intersections_to_ignore++;
+        continue;
+      }
+      
+      intersections_seen = follow_segment_continuous(intersections_to_ignore);
+      if (intersections_seen <= intersections_to_ignore)
+      {
+        recover_from_dead_end(intersections_seen);
+        return;
+      }
+      
+      for (uint8_t j = 0; j <= intersections_to_ignore; j++)
+        advance_to_next_node();
+      intersections_to_ignore = 0;
+    }
+    
+    play_from_program_space(run_turn_sound);
+    turn_continuous(path[i]);
+  }
+  
+  // Follow the last segment up to the finish, and pull onto it as in
+  // run_maze_conservative().
+  intersections_seen = follow_segment_continuous(intersections_to_ignore);
+  if (intersections_seen <= intersections_to_ignore)
+  {
+    recover_from_dead_end(intersections_seen);
+    return;
+  }
+  drive_motors(40,40);
   delay_ms(200);
-  set_motors(0, 0);
+  drive_motors(0, 0);
+  beacon_run_finish();
   play_from_program_space(done_sound);
+  save_adapted_calibration();
+}
 
-  // Now we should be at the finish!
+// A turn parameter scaled from turn-table.h for the speed band the
+// robot comes into the turn at.
+int16_t turn_param(uint8_t param, uint8_t type, uint8_t band, uint8_t column)
+{
+  return (long)params[param] * pgm_read_byte(&turn_table[type][band][column]) / TURN_SCALE_ONE;
 }
 
-void turn_aggressive(char turn_dir)
+// The turn parameters are tuned for coming in at the crawl the fast
+// follower brakes to; faster entries take the same arc faster.
+// entry_power is what the robot is driving at coming into the turn, 0
+// from a standstill.
+void turn_aggressive(char turn_dir, uint8_t entry_power)
 {
+  uint8_t band = 0;
+  if (entry_power > TURN_BAND_FLOOR)
+    band = (entry_power - TURN_BAND_FLOOR) / TURN_BAND_WIDTH;
+  if (band >= TURN_SPEED_BANDS)
+    band = TURN_SPEED_BANDS - 1;
+  
+  if (turn_dir != 'S')
+    beacon(BEACON_TURN_START);
+    
   switch(turn_dir)
   {
   case 'L':
     // Turn left.
-    set_motors(-20,130);
-    delay_ms(200);
+    dir = left_of(dir);
+    drive_motors(turn_param(PARAM_FAST_INNER, TURN_SIDE, band, TURN_INNER), turn_param(PARAM_FAST_OUTER, TURN_SIDE, band, TURN_OUTER));
+    delay_ms(turn_param(PARAM_FAST_TURN_MS, TURN_SIDE, band, TURN_MS));
     break;
   case 'R':
     // Turn right.
-    set_motors(130,-20);
-    delay_ms(200);
+    dir = right_of(dir);
+    drive_motors(turn_param(PARAM_FAST_OUTER, TURN_SIDE, band, TURN_OUTER), turn_param(PARAM_FAST_INNER, TURN_SIDE, band, TURN_INNER));
+    delay_ms(turn_param(PARAM_FAST_TURN_MS, TURN_SIDE, band, TURN_MS));
     break;
   case 'B':
     // Turn around.
-    set_motors(120,-120);
-    delay_ms(300);
+    dir = flip(dir);
+    drive_motors(turn_param(PARAM_FAST_BACK, TURN_BACK, band, TURN_OUTER), -turn_param(PARAM_FAST_BACK, TURN_BACK, band, TURN_INNER));
+    delay_ms(turn_param(PARAM_FAST_BACK_MS, TURN_BACK, band, TURN_MS));
     break;
   case 'S':
     // Don't do anything!
-    break;
+    return;
   }    
+  
+  beacon(BEACON_TURN_END);
 }
 
-void run_maze_aggressive()
+// Drives the path from the start at speed.  The last straight normally
+// isn't braked for, since the run stops on the finish square; in lap
+// mode it is, and a lap back to a dead-end start ends on that dead end
+// rather than treating it as a line gone missing.  Returns true on
+// arriving, with here and dir up to date, or false if the run went
+// wrong and has recovered as best it could.
+bool drive_path_aggressive(bool brake_at_end, bool end_at_dead_end)
 {
-  uint8_t straight_seg_length = 0, intersections_to_ignore = 0;
+  uint16_t straight_seg_length = 0;
+  uint8_t top_speed = 255;
+  uint8_t intersections_to_ignore = 0;
+  uint8_t intersections_seen;
+  uint8_t entry_power = 0; // we start from a standstill
+  
+  here = start;
+  dir = start_dir;
+  beacon_run_start();
   
   for(uint8_t i = 0; i < (path_length - 1); i++) // path ends with 'X'
   {
     if (path_seg_lengths[i] > 0)
     {
       straight_seg_length += path_seg_lengths[i];
+      if (path_speeds[i] && path_speeds[i] < top_speed)
+        top_speed = path_speeds[i];
       
       if (path[i] == 'S')
       {
@@ -674,20 +916,215 @@ void run_maze_aggressive()
         continue;
       }
       
-      follow_segment_aggressive(straight_seg_length, intersections_to_ignore);
+      intersections_seen = follow_segment_aggressive(straight_seg_length, &path_seg_lengths[i - intersections_to_ignore], intersections_to_ignore, top_speed);
+      bool missed = overshot;
+      entry_power = exit_power;
+      if (!missed && intersections_seen <= intersections_to_ignore)
+      {
+        recover_from_dead_end(intersections_seen);
+        return false;
+      }
       
+      for (uint8_t j = 0; j <= intersections_to_ignore; j++)
+        advance_to_next_node();
       straight_seg_length = 0;
+      top_speed = 255;
       intersections_to_ignore = 0;
+      
+      if (missed)
+      {
+        // come back to the turn and carry on from there
+        back_to_missed_node();
+        turn(turn_from_behind(path[i]));
+        entry_power = 0;
+        continue;
+      }
     }      
 
     // Make a turn according to the instruction stored in
     // path[i].
     play_from_program_space(run_turn_sound);
-    turn_aggressive(path[i]);
+    turn_aggressive(path[i], entry_power);
+    entry_power = 0; // nothing is followed between two turns in a row
   }
     
   // Follow the last segment up to the finish.
-  follow_segment_aggressive(MAZE_SIZE, intersections_to_ignore); // don't bother slowing down in anticipation
-  set_motors(0, 0);
-  play_from_program_space(done_sound);
-}
\ No newline at end of file
+  uint8_t last = path_length - 1;
+  if (path_speeds[last] && path_speeds[last] < top_speed)
+    top_speed = path_speeds[last];
+  if (brake_at_end)
+    intersections_seen = follow_segment_aggressive(straight_seg_length + path_seg_lengths[last], &path_seg_lengths[last - intersections_to_ignore], intersections_to_ignore, top_speed);
+  else
+    intersections_seen = follow_segment_aggressive(MAZE_SIZE * SEG_LENGTH_SCALE, NULL, intersections_to_ignore, top_speed); // don't bother slowing down in anticipation
+  
+  if (overshot && !end_at_dead_end)
+  {
+    // drove past a finish that is an intersection, in lap mode
+    back_to_missed_node();
+    intersections_seen = intersections_to_ignore + 1;
+  }
+  if (end_at_dead_end && intersections_seen > intersections_to_ignore)
+  {
+    // stopped at an intersection short of the dead end; we don't know
+    // which
+    drive_motors(0, 0);
+    beacon_run_finish();
+    play("!<c4<c4");
+    return false;
+  }
+  if (intersections_seen < intersections_to_ignore + !end_at_dead_end)
+  {
+    recover_from_dead_end(intersections_seen);
+    return false;
+  }
+  drive_motors(0, 0);
+  beacon_run_finish();
+  here = finish;
+  return true;
+}
+
+void run_maze_aggressive()
+{
+  start_dir = NORTH;
+  if (drive_path_aggressive(false, false))
+  {
+    play_from_program_space(done_sound);
+    save_adapted_calibration();
+  }
+}
+
+uint8_t count_exits(int8_t x, int8_t y)
+{
+  uint8_t exits = 0;
+  
+  for (uint8_t d = NORTH; d <= WEST; d++)
+  {
+    if (has_mapped_exit(x, y, d))
+      exits++;
+  }
+  return exits;
+}
+
+// True if the followers stop at (x, y) by themselves, which is
+// anywhere but partway along a straight line.
+bool is_stop(int8_t x, int8_t y)
+{
+  for (uint8_t d = NORTH; d <= EAST; d++)
+  {
+    if (is_corridor(x, y, d) && has_mapped_exit(x, y, flip(d)))
+      return false;
+  }
+  return true;
+}
+
+// the last laps run_laps() keeps, to show once it stops
+#define LAP_LOG_SIZE 8
+#define LAP_SHOW_MS  1500 // each pair of them stays on the LCD this long
+
+void display_lap_summary(unsigned long best_ms, unsigned long average_ms)
+{
+  display_clear();
+  display_print("B ");
+  display_print_long(best_ms);
+  display_goto(0, 1);
+  display_print("A ");
+  display_print_long(average_ms);
+  display_flush(DISPLAY_CHARS);
+}
+
+// Shows the logged laps two at a time, as lap number and ms, oldest
+// first.  Laps over 65 s show as 65535.
+void display_lap_log(const uint16_t *lap_log, uint16_t laps)
+{
+  uint16_t lap = (laps > LAP_LOG_SIZE) ? laps - LAP_LOG_SIZE : 0;
+  
+  while (lap < laps)
+  {
+    display_clear();
+    for (uint8_t row = 0; row < 2 && lap < laps; row++, lap++)
+    {
+      display_goto(0, row);
+      display_print_long(lap + 1);
+      display_print(":");
+      display_print_long(lap_log[lap % LAP_LOG_SIZE]);
+    }
+    display_flush(DISPLAY_CHARS);
+    delay_ms(LAP_SHOW_MS);
+  }
+}
+
+// Lap mode: runs from the start to the finish and back again at speed,
+// over and over, planning each way from wherever and however the robot
+// stopped by treating that as the start.  A lap is there and back,
+// turnarounds and planning included.  It stops when a button is held at
+// the end of a run, or a run goes wrong.  Each run shows on the beacon,
+// and the LCD shows the best and average lap in ms.  Once it stops, the
+// LCD goes through the last LAP_LOG_SIZE laps and then back to the best
+// and average.
+void run_laps()
+{
+  pos home = start, away = finish;
+  unsigned long best_ms = 0xFFFFFFFF;
+  unsigned long total_ms = 0;
+  uint16_t lap_log[LAP_LOG_SIZE];
+  uint16_t laps = 0;
+  bool back = false;
+  
+  if (!is_stop(home.x, home.y))
+  {
+    // we couldn't tell we were home again
+    play("!<c4<c4");
+    return;
+  }
+  
+  here = home;
+  dir = NORTH;
+  unsigned long lap_start_ms = get_ms();
+  
+  while (1)
+  {
+    start = here;
+    start_dir = dir;
+    finish = back ? home : away;
+    fill_all_costs();
+    build_path();
+    if (!path_length || path[path_length - 1] != 'X')
+      break; // no route
+    
+    // only the finish square stops the robot by itself
+    if (!drive_path_aggressive(true, back && count_exits(home.x, home.y) == 1))
+      break;
+    
+    if (back)
+    {
+      unsigned long lap_ms = get_ms() - lap_start_ms;
+      lap_start_ms = get_ms();
+      lap_log[laps % LAP_LOG_SIZE] = (lap_ms > UINT16_MAX) ? UINT16_MAX : lap_ms;
+      laps++;
+      total_ms += lap_ms;
+      if (lap_ms < best_ms)
+        best_ms = lap_ms;
+      
+      display_lap_summary(best_ms, total_ms / laps);
+    }
+    back = !back;
+    
+    if (button_is_pressed(BUTTON_A | BUTTON_B | BUTTON_C))
+      break;
+  }
+  
+  // leave the map as the single runs expect it
+  drive_motors(0, 0);
+  start = home;
+  start_dir = NORTH;
+  finish = away;
+  fill_all_costs();
+  build_path();
+  save_adapted_calibration();
+  
+  if (laps)
+  {
+    display_lap_log(lap_log, laps);
+    display_lap_summary(best_ms, total_ms / laps);
+  }
+}
@@ -1,6 +1,15 @@
+#ifndef __maze_solve_h
+#define __maze_solve_h
+
+#include <stdint.h>
+
 void map_maze();
 void run_maze_conservative();
+void run_maze_continuous();
 void run_maze_aggressive();
+void run_laps();
+
+#endif
 
 // Local Variables: **
 // mode: C **
@@ -0,0 +1,52 @@
+/*
+ * This file scales motor commands for the battery voltage.
+ *
+ * The motors run straight off the batteries, so the wheel speed you get
+ * for a given set_motors() value drops as the batteries drain.  Every
+ * speed-dependent constant (the time per cell used for mapping, the
+ * aggressive braking point, the turn durations) assumes a particular
+ * wheel speed, so drive_motors() scales each command by
+ * NOMINAL_BATTERY_MV / (battery voltage) to keep that speed constant.
+ */
+
+#include <pololu/3pi.h>
+#include "motors.h"
+
+// how often to re-read the battery; a reading takes about a millisecond
+#define BATTERY_SAMPLE_MS 250
+
+// motor command scale, NOMINAL_BATTERY_MV / battery in 8.8 fixed point
+uint16_t motor_scale = 256;
+unsigned long last_sample_ms;
+bool sampled;
+
+void sample_battery()
+{
+  int bat = read_battery_millivolts();
+  
+  if (bat > 0)
+    motor_scale = ((unsigned long)NOMINAL_BATTERY_MV * 256 + bat / 2) / bat;
+  
+  last_sample_ms = get_ms();
+  sampled = true;
+}
+
+int scale_motor(int power)
+{
+  long scaled = ((long)power * motor_scale) >> 8;
+  
+  // a weak battery can't be made up for beyond full power
+  if (scaled > 255)
+    return 255;
+  if (scaled < -255)
+    return -255;
+  return scaled;
+}
+
+void drive_motors(int left, int right)
+{
+  if (!sampled || (get_ms() - last_sample_ms) >= BATTERY_SAMPLE_MS)
+    sample_battery();
+  
+  set_motors(scale_motor(left), scale_motor(right));
+}
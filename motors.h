@@ -0,0 +1,14 @@
+#ifndef __motors_h
+#define __motors_h
+
+// The battery voltage the speed constants in follow-segment.c and
+// maze-solve.c were tuned at.  Motor commands are scaled so the wheels
+// turn as fast as they would at this voltage.
+#ifndef NOMINAL_BATTERY_MV
+#define NOMINAL_BATTERY_MV 4800
+#endif
+
+void sample_battery();
+void drive_motors(int left, int right);
+
+#endif
@@ -0,0 +1,129 @@
+/*
+ * This file holds the tunable constants: their defaults, a copy in
+ * EEPROM, and a menu for changing them at the track without reflashing.
+ *
+ * Hold B while turning the robot on to get the menu.  Each parameter is
+ * shown in turn: A and C step its value down and up (and repeat when
+ * held), A and C together put back the default, and B moves on.  After
+ * the last one the table is saved.
+ */
+
+#include <pololu/3pi.h>
+#include <avr/pgmspace.h>
+#include <avr/eeprom.h>
+#include <stdlib.h>
+#include "params.h"
+
+// Stored tables with any other version are ignored in favour of the
+// defaults, so a firmware with a different list doesn't misread them.
+#define PARAMS_VERSION 1
+
+const int16_t param_defaults[PARAM_COUNT] PROGMEM = {
+  60, 20, 10000, 3,     // speed, PID
+  709, 65,              // segment timing
+  137, 130, -20, 200,   // aggressive
+  120, 300,
+  100, 200, 600, 100,   // sensor thresholds
+};
+
+// Each value is kept within these, on load as well as when edited, so
+// that no divisor reaches zero and no timing goes negative.
+const int16_t param_limits[PARAM_COUNT][2] PROGMEM = {
+  {10, 255}, {1, 1000}, {1, 30000}, {0, 100},    // speed, PID
+  {100, 3000}, {0, 1000},                        // segment timing
+  {30, 1000}, {0, 255}, {-255, 255}, {10, 1000}, // aggressive
+  {0, 255}, {10, 2000},
+  {0, 1000}, {0, 1000}, {0, 1000}, {0, 1000},    // sensor thresholds
+};
+
+const char param_names[PARAM_COUNT][9] PROGMEM = {
+  "Speed", "P div", "I div", "D x2",
+  "Cell ms", "Seg ms",
+  "FastCell", "FastOut", "FastIn", "FTurn ms",
+  "FastBack", "FBack ms",
+  "Side", "Line", "Finish", "Lost",
+};
+
+int16_t params[PARAM_COUNT];
+
+uint8_t EEMEM stored_params_version;
+int16_t EEMEM stored_params[PARAM_COUNT];
+
+
+void clamp_param(uint8_t i)
+{
+  int16_t min = pgm_read_word(&param_limits[i][0]);
+  int16_t max = pgm_read_word(&param_limits[i][1]);
+  
+  if (params[i] < min)
+    params[i] = min;
+  else if (params[i] > max)
+    params[i] = max;
+}
+
+void load_params()
+{
+  if (eeprom_read_byte(&stored_params_version) == PARAMS_VERSION)
+  {
+    eeprom_read_block(params, stored_params, sizeof(params));
+    for (uint8_t i = 0; i < PARAM_COUNT; i++)
+      clamp_param(i);
+  }
+  else
+  {
+    for (uint8_t i = 0; i < PARAM_COUNT; i++)
+      params[i] = pgm_read_word(&param_defaults[i]);
+  }
+}
+
+void save_params()
+{
+  eeprom_update_block(params, stored_params, sizeof(params));
+  eeprom_update_byte(&stored_params_version, PARAMS_VERSION);
+}
+
+void edit_params()
+{
+  uint8_t i = 0;
+  
+  clear();
+  print("Tuning");
+  wait_for_button_release(BUTTON_B);
+  
+  while (i < PARAM_COUNT)
+  {
+    clear();
+    print_from_program_space(param_names[i]);
+    lcd_goto_xy(0,1);
+    print_long(params[i]);
+    
+    unsigned char button = wait_for_button_press(BUTTON_A | BUTTON_B | BUTTON_C);
+    delay_ms(30); // give the other button a chance to go down too
+    
+    if (button == BUTTON_B)
+    {
+      wait_for_button_release(BUTTON_B);
+      i++;
+    }
+    else if (button_is_pressed(BUTTON_A) && button_is_pressed(BUTTON_C))
+    {
+      params[i] = pgm_read_word(&param_defaults[i]);
+      wait_for_button_release(BUTTON_A | BUTTON_C);
+    }
+    else
+    {
+      // bigger steps for bigger numbers
+      int16_t step = (abs(params[i]) >= 1000) ? 100 : (abs(params[i]) >= 100) ? 10 : 1;
+      params[i] += (button == BUTTON_C) ? step : -step;
+      clamp_param(i);
+      
+      delay_ms(150); // repeat rate while held
+    }
+  }
+  
+  save_params();
+  clear();
+  print("Saved");
+  play(">c16g16");
+  delay_ms(500);
+}
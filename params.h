@@ -0,0 +1,35 @@
+#ifndef __params_h
+#define __params_h
+
+#include <stdint.h>
+
+// Tunable constants, editable from the menu at boot and kept in EEPROM.
+// Bump PARAMS_VERSION in params.c whenever this list changes, and give
+// each one limits in param_limits there.
+enum
+{
+  PARAM_SPEED,        // follow_segment() top speed
+  PARAM_P_DIV,        // PID: proportional / P_DIV
+  PARAM_I_DIV,        //      integral / I_DIV
+  PARAM_D_HALVES,     //      derivative * D_HALVES / 2
+  PARAM_CELL_MS,      // mapping: ms per cell
+  PARAM_SEG_MS,       //          plus ms per segment
+  PARAM_FAST_CELL_MS, // aggressive: ms per cell at full speed
+  PARAM_FAST_OUTER,   //             turn, outer wheel
+  PARAM_FAST_INNER,   //             turn, inner wheel
+  PARAM_FAST_TURN_MS, //             turn time
+  PARAM_FAST_BACK,    //             turn around, wheel speed
+  PARAM_FAST_BACK_MS, //             turn around time
+  PARAM_SIDE,         // sensor thresholds: side exit when identifying
+  PARAM_LINE,         //                    intersection or line ahead
+  PARAM_FINISH,       //                    finish square
+  PARAM_LOST,         //                    dead end
+  PARAM_COUNT
+};
+
+extern int16_t params[PARAM_COUNT];
+
+void load_params();
+void edit_params();
+
+#endif
@@ -0,0 +1,164 @@
+/*
+ * Solved mazes kept in EEPROM, so that a layout that comes back can be
+ * recognised and run without mapping it again.
+ *
+ * Each profile holds the map as one bit per edge, the start and finish,
+ * the path, and a fingerprint of the first FINGERPRINT_LENGTH segments
+ * of mapping: their measured lengths and the exits found at their ends.
+ * Mapping always sets off the same way in the same maze, so map_maze()
+ * notes the fingerprint as it goes and, once it has enough, looks for a
+ * profile that matches.  Trims aren't kept; the path has the measured
+ * lengths, and map_maze() puts them back on the map from there.
+ *
+ * A new profile goes in the slot of one whose fingerprint matches, since
+ * that maze must have changed, or else the next slot round.
+ */
+
+#include <avr/eeprom.h>
+#include "maze-config.h"
+#include "map-format.h"
+#include "maze-map.h"
+#include "profiles.h"
+
+// Stored profiles with any other version or map size are ignored, so a
+// firmware with a different layout doesn't misread them.
+#define PROFILE_VERSION 1
+
+// lengths within this many 1/SEG_LENGTH_SCALE cells count as the same
+#define FINGERPRINT_TOLERANCE 8
+
+#define PROFILE_EDGE_BYTES ((MAZE_SIZE * MAZE_SIZE * 2 + 7) / 8)
+
+typedef struct profile
+{
+  uint8_t version;
+  uint8_t maze_size;
+  uint8_t lengths[FINGERPRINT_LENGTH]; // in 1/SEG_LENGTH_SCALE cells
+  uint8_t exits[FINGERPRINT_LENGTH];
+  uint8_t ends[4];
+  uint8_t path_length;
+  uint8_t edges[PROFILE_EDGE_BYTES]; // north and east bits, x fastest
+  char path[MAX_PATH_LENGTH];
+  uint8_t path_seg_lengths[MAX_PATH_LENGTH];
+} profile;
+
+profile EEMEM stored_profiles[PROFILE_COUNT];
+uint8_t EEMEM next_profile;
+
+#ifdef PROFILE_EEPROM_BUDGET
+_Static_assert(sizeof(stored_profiles) + 1 <= PROFILE_EEPROM_BUDGET,
+  "the profiles don't fit in the EEPROM; lower PROFILE_COUNT");
+#endif
+
+// the fingerprint of the maze being mapped
+uint8_t fingerprint_lengths[FINGERPRINT_LENGTH];
+uint8_t fingerprint_exits[FINGERPRINT_LENGTH];
+
+void note_fingerprint(uint8_t i, uint16_t length, uint8_t exits)
+{
+  fingerprint_lengths[i] = length > UINT8_MAX ? UINT8_MAX : length;
+  fingerprint_exits[i] = exits;
+}
+
+bool fingerprint_matches(uint8_t slot)
+{
+  profile *p = &stored_profiles[slot];
+
+  if (eeprom_read_byte(&p->version) != PROFILE_VERSION || eeprom_read_byte(&p->maze_size) != MAZE_SIZE)
+    return false;
+
+  for (uint8_t i = 0; i < FINGERPRINT_LENGTH; i++)
+  {
+    int16_t diff = eeprom_read_byte(&p->lengths[i]) - fingerprint_lengths[i];
+    if (eeprom_read_byte(&p->exits[i]) != fingerprint_exits[i] ||
+        diff > FINGERPRINT_TOLERANCE || diff < -FINGERPRINT_TOLERANCE)
+      return false;
+  }
+  return true;
+}
+
+uint8_t get_profile_edges(uint8_t slot, int8_t x, int8_t y)
+{
+  uint16_t bit = ((uint16_t)y * MAZE_SIZE + x) * 2;
+  uint8_t byte = eeprom_read_byte(&stored_profiles[slot].edges[bit / 8]);
+  return (byte >> (bit % 8)) & (MAP_NORTH_EDGE | MAP_EAST_EDGE);
+}
+
+void get_profile_ends(uint8_t slot, uint8_t *ends)
+{
+  eeprom_read_block(ends, stored_profiles[slot].ends, 4);
+}
+
+// Returns false, leaving the path alone, if the stored one is no good.
+bool load_profile_path(uint8_t slot)
+{
+  profile *p = &stored_profiles[slot];
+  uint8_t n = eeprom_read_byte(&p->path_length);
+
+  if (n == 0 || n > MAX_PATH_LENGTH || eeprom_read_byte((uint8_t *)&p->path[n - 1]) != 'X')
+    return false;
+
+  eeprom_read_block(path, p->path, n);
+  eeprom_read_block(path_seg_lengths, p->path_seg_lengths, n);
+  for (uint8_t i = 0; i < n; i++)
+    path_speeds[i] = 0;
+  path_length = n;
+  return true;
+}
+
+// Saves the maze just mapped, with the fingerprint noted while mapping
+// it.
+void save_profile()
+{
+  uint8_t slot = PROFILE_COUNT;
+
+  for (uint8_t i = 0; i < PROFILE_COUNT; i++)
+  {
+    if (fingerprint_matches(i))
+      slot = i;
+  }
+  if (slot == PROFILE_COUNT)
+  {
+    slot = eeprom_read_byte(&next_profile);
+    if (slot >= PROFILE_COUNT)
+      slot = 0;
+    eeprom_update_byte(&next_profile, (slot + 1) % PROFILE_COUNT);
+  }
+
+  profile *p = &stored_profiles[slot];
+  uint8_t ends[4];
+
+  // half written, it mustn't match anything
+  eeprom_update_byte(&p->version, 0xFF);
+
+  eeprom_update_byte(&p->maze_size, MAZE_SIZE);
+  eeprom_update_block(fingerprint_lengths, p->lengths, FINGERPRINT_LENGTH);
+  eeprom_update_block(fingerprint_exits, p->exits, FINGERPRINT_LENGTH);
+  get_map_ends(ends);
+  eeprom_update_block(ends, p->ends, sizeof(ends));
+
+  // a byte at a time, which is four cells
+  for (uint16_t i = 0; i < PROFILE_EDGE_BYTES; i++)
+  {
+    uint8_t byte = 0;
+    for (uint8_t k = 0; k < 4; k++)
+    {
+      uint16_t cell = i * 4 + k;
+      if (cell < MAZE_SIZE * MAZE_SIZE)
+        byte |= (get_map_edges(cell % MAZE_SIZE, cell / MAZE_SIZE) & (MAP_NORTH_EDGE | MAP_EAST_EDGE)) << (k * 2);
+    }
+    eeprom_update_byte(&p->edges[i], byte);
+  }
+
+  eeprom_update_block(path, p->path, path_length);
+  eeprom_update_block(path_seg_lengths, p->path_seg_lengths, path_length);
+  eeprom_update_byte(&p->path_length, path_length);
+
+  eeprom_update_byte(&p->version, PROFILE_VERSION);
+}
+
+void clear_profiles()
+{
+  for (uint8_t i = 0; i < PROFILE_COUNT; i++)
+    eeprom_update_byte(&stored_profiles[i].version, 0xFF);
+}
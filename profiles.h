@@ -0,0 +1,27 @@
+#ifndef __profiles_h
+#define __profiles_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// segments of mapping that make up a maze's fingerprint
+#define FINGERPRINT_LENGTH 6
+
+// fingerprint exit bits
+#define FINGERPRINT_LEFT     0x01
+#define FINGERPRINT_STRAIGHT 0x02
+#define FINGERPRINT_RIGHT    0x04
+#define FINGERPRINT_FINISH   0x08
+
+void note_fingerprint(uint8_t i, uint16_t length, uint8_t exits);
+bool fingerprint_matches(uint8_t slot);
+
+// A stored map has only whole edges, MAP_NORTH_EDGE | MAP_EAST_EDGE.
+uint8_t get_profile_edges(uint8_t slot, int8_t x, int8_t y);
+void get_profile_ends(uint8_t slot, uint8_t *ends); // start x, y, finish x, y
+bool load_profile_path(uint8_t slot);
+
+void save_profile();
+void clear_profiles();
+
+#endif
@@ -0,0 +1,106 @@
+/*
+ * This file paces the line following loops and fills their spare time.
+ *
+ * Every timer on the 3pi is taken by the motors, the buzzer or the clock,
+ * so the control tick is kept by polling get_ticks().  wait_for_tick()
+ * runs slices of the background tasks, and then LCD output, until too
+ * little of the tick is left for another slice, then waits out the rest.
+ * That way each pass of a following loop starts CONTROL_PERIOD_TICKS
+ * after the last, however much planning is waiting, and the planning
+ * gets done while the robot drives.
+ */
+
+#include <pololu/3pi.h>
+#include "display.h"
+#include "scheduler.h"
+#include "beacon.h"
+
+#define MAX_TASKS 4
+
+task tasks[MAX_TASKS];
+uint8_t task_count;
+uint8_t next_task; // round robin
+
+unsigned long next_tick;
+
+void run_in_background(task t)
+{
+  for (uint8_t i = 0; i < task_count; i++)
+  {
+    if (tasks[i] == t)
+      return;
+  }
+  
+  if (task_count == MAX_TASKS)
+  {
+    // nowhere to put it; do it now
+    while (t());
+    return;
+  }
+  
+  tasks[task_count++] = t;
+}
+
+// Runs one slice of the next task, dropping the task once it's done.
+void run_slice()
+{
+  if (next_task >= task_count)
+    next_task = 0;
+    
+  if (tasks[next_task]())
+  {
+    next_task++;
+    return;
+  }
+  
+  task_count--;
+  for (uint8_t i = next_task; i < task_count; i++)
+    tasks[i] = tasks[i + 1];
+}
+
+void finish_background()
+{
+  while (task_count)
+    run_slice();
+}
+
+void start_ticks()
+{
+  next_tick = get_ticks();
+}
+
+void wait_for_tick()
+{
+  while ((long)(next_tick - get_ticks()) > SLICE_TICKS)
+  {
+    if (task_count)
+      run_slice();
+    else if (!display_flush(1))
+      break;
+  }
+  
+  while ((long)(next_tick - get_ticks()) > 0);
+  
+  next_tick += CONTROL_PERIOD_TICKS;
+  
+  // after a tick that ran long, start counting again from now rather
+  // than running several ticks back to back; the beacon shows where
+  if ((long)(get_ticks() - next_tick) > 0)
+  {
+    beacon(BEACON_TICK_OVERRUN);
+    next_tick = get_ticks() + CONTROL_PERIOD_TICKS;
+  }
+}
+
+// delay_ms(), but doing background work while waiting.
+void background_delay_ms(unsigned int ms)
+{
+  unsigned long end = get_ticks() + ms * 2500UL;
+  
+  while (task_count && (long)(end - get_ticks()) > SLICE_TICKS)
+    run_slice();
+    
+  long left = end - get_ticks();
+  if (left > 0)
+    delay_ms(left / 2500);
+}
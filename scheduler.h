@@ -0,0 +1,27 @@
+#ifndef __scheduler_h
+#define __scheduler_h
+
+#include <stdbool.h>
+
+// The line following loops run once per control tick, in get_ticks()
+// units of 0.4 us.  1.5 ms is about what the loops took before they were
+// paced, so the PID constants still apply.  It doesn't follow the sensor
+// read timeout: a faster loop would need them tuned again, so a shorter
+// read just leaves more of the tick to the background.
+#define CONTROL_PERIOD_TICKS 3750
+
+// No background slice may take longer than this.
+#define SLICE_TICKS 500
+
+// A background task does a bounded slice of work per call and returns
+// true while it has more to do.
+typedef bool (*task)();
+
+void run_in_background(task t);
+void finish_background();
+
+void start_ticks();
+void wait_for_tick();
+void background_delay_ms(unsigned int ms);
+
+#endif
@@ -8,6 +8,7 @@ extern const char go_sound[] PROGMEM;
 extern const char done_sound[] PROGMEM;
 extern const char map_turn_sound[] PROGMEM;
 extern const char run_turn_sound[] PROGMEM;
+extern const char detour_sound[] PROGMEM;
 
 void move_sound();
 
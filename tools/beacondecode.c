@@ -0,0 +1,257 @@
+/*
+ * beacondecode - turns a logic analyser capture of the IO_D0 event
+ * beacon (see beacon.h) into latency tables.
+ *
+ * The capture is either a CSV export with the time in seconds in the
+ * first column and the pin level in a later one, one row per sample or
+ * per transition, or with -r a raw dump of one byte per sample at the
+ * given sample rate, the pin being bit -c of each byte.  High pulses
+ * shorter than BEACON_MAX_PULSE_US are counted into bursts, and a burst
+ * ends at the first low stretch longer than BEACON_MAX_SPACE_US.  Longer
+ * highs are the pull-up between runs and are ignored.
+ *
+ * usage: beacondecode [-r sample_rate] [-c channel] [-s] [capture]
+ *   -r  read a raw capture sampled at sample_rate Hz
+ *   -c  column after the time (CSV) or bit (raw) holding IO_D0, default 0
+ *   -s  print each run's intersection splits
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include "beacon.h"
+
+#define BEACON_MAX_PULSE_US 5.0
+#define BEACON_MAX_SPACE_US 1.0
+
+#define MAX_SPLITS 256
+
+typedef struct stat
+{
+  const char *name;
+  unsigned long count;
+  double min, max, sum;
+} stat;
+
+static stat stats[] = {
+  { "segment" },            // segment start to intersection
+  { "intersection->turn" }, // intersection to turn start
+  { "turn" },               // turn start to turn end
+  { "run" },                // run start to run finish
+};
+
+#define STAT_SEGMENT  0
+#define STAT_DECISION 1
+#define STAT_TURN     2
+#define STAT_RUN      3
+
+static bool show_splits;
+
+// burst being received
+static double rise_time, fall_time, burst_time;
+static int level = 1, pulses;
+
+// previous event
+static int last_event;
+static double last_time;
+
+// run in progress
+static bool in_run;
+static double run_time, splits[MAX_SPLITS];
+static unsigned int split_count, runs, run_overruns;
+
+static unsigned long overruns; // control ticks that started late
+
+static void add_stat(int s, double seconds)
+{
+  double ms = seconds * 1e3;
+
+  if (!stats[s].count || ms < stats[s].min)
+    stats[s].min = ms;
+  if (!stats[s].count || ms > stats[s].max)
+    stats[s].max = ms;
+  stats[s].sum += ms;
+  stats[s].count++;
+}
+
+static void event(int e, double t)
+{
+  if (e < BEACON_SEGMENT_START || e > BEACON_TICK_OVERRUN)
+  {
+    fprintf(stderr, "%.6f: bad burst of %d pulses\n", t, e);
+    last_event = 0;
+    return;
+  }
+
+  // an overrun can come in the middle of any interval, so it mustn't
+  // end one
+  if (e == BEACON_TICK_OVERRUN)
+  {
+    overruns++;
+    run_overruns++;
+    return;
+  }
+
+  if (last_event == BEACON_SEGMENT_START && e == BEACON_INTERSECTION)
+    add_stat(STAT_SEGMENT, t - last_time);
+  if (last_event == BEACON_INTERSECTION && e == BEACON_TURN_START)
+    add_stat(STAT_DECISION, t - last_time);
+  if (last_event == BEACON_TURN_START && e == BEACON_TURN_END)
+    add_stat(STAT_TURN, t - last_time);
+
+  switch (e)
+  {
+  case BEACON_RUN_START:
+    in_run = true;
+    run_time = t;
+    split_count = 0;
+    run_overruns = 0;
+    break;
+  case BEACON_INTERSECTION:
+    if (in_run && split_count < MAX_SPLITS)
+      splits[split_count++] = t - run_time;
+    break;
+  case BEACON_RUN_FINISH:
+    if (!in_run)
+      break;
+    in_run = false;
+    add_stat(STAT_RUN, t - run_time);
+    runs++;
+    if (show_splits)
+    {
+      printf("run %u: %.1f ms, %u intersections, %u tick overruns\n", runs, (t - run_time) * 1e3, split_count, run_overruns);
+      for (unsigned int i = 0; i < split_count; i++)
+        printf("  %3u %9.1f ms\n", i + 1, splits[i] * 1e3);
+    }
+    break;
+  }
+
+  last_event = e;
+  last_time = t;
+}
+
+static void end_burst()
+{
+  if (pulses)
+    event(pulses, burst_time);
+  pulses = 0;
+}
+
+// Feeds one sample or transition of the pin.
+static void sample(double t, int new_level)
+{
+  if (new_level == level)
+  {
+    if (pulses && !level && (t - fall_time) * 1e6 > BEACON_MAX_SPACE_US)
+      end_burst();
+    return;
+  }
+
+  level = new_level;
+  if (level)
+  {
+    if (pulses && (t - fall_time) * 1e6 > BEACON_MAX_SPACE_US)
+      end_burst();
+    rise_time = t;
+  }
+  else
+  {
+    fall_time = t;
+    if ((t - rise_time) * 1e6 < BEACON_MAX_PULSE_US)
+    {
+      if (!pulses)
+        burst_time = rise_time;
+      pulses++;
+    }
+    else
+      pulses = 0;
+  }
+}
+
+static void read_csv(FILE *f, int column)
+{
+  char line[256];
+
+  while (fgets(line, sizeof(line), f))
+  {
+    char *p = line, *end;
+    double t = strtod(p, &end);
+
+    // skips the header and anything else that isn't a sample
+    if (end == p)
+      continue;
+
+    p = end;
+    for (int i = 0; i <= column && p; i++)
+    {
+      p = strchr(p, ',');
+      if (p)
+        p++;
+    }
+    if (!p)
+      continue;
+
+    sample(t, atoi(p) ? 1 : 0);
+  }
+}
+
+static void read_raw(FILE *f, double rate, int channel)
+{
+  unsigned long n = 0;
+  int c;
+
+  while ((c = getc(f)) != EOF)
+    sample(n++ / rate, (c >> channel) & 1);
+}
+
+int main(int argc, char **argv)
+{
+  double rate = 0;
+  int channel = 0;
+  int opt;
+  FILE *f = stdin;
+
+  while ((opt = getopt(argc, argv, "r:c:s")) != -1)
+  {
+    switch (opt)
+    {
+    case 'r': rate = atof(optarg); break;
+    case 'c': channel = atoi(optarg); break;
+    case 's': show_splits = true; break;
+    default:
+      fprintf(stderr, "usage: %s [-r sample_rate] [-c channel] [-s] [capture]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  if (optind < argc && !(f = fopen(argv[optind], rate ? "rb" : "r")))
+  {
+    perror(argv[optind]);
+    return 1;
+  }
+
+  if (rate)
+    read_raw(f, rate, channel);
+  else
+    read_csv(f, channel);
+  end_burst();
+
+  if (in_run)
+    fprintf(stderr, "capture ends during a run\n");
+
+  printf("%-20s %7s %10s %10s %10s\n", "interval", "count", "min ms", "mean ms", "max ms");
+  for (unsigned int i = 0; i < sizeof(stats) / sizeof(stats[0]); i++)
+  {
+    if (!stats[i].count)
+      printf("%-20s %7lu\n", stats[i].name, 0UL);
+    else
+      printf("%-20s %7lu %10.3f %10.3f %10.3f\n", stats[i].name, stats[i].count,
+        stats[i].min, stats[i].sum / stats[i].count, stats[i].max);
+  }
+  printf("%-20s %7lu\n", "tick overruns", overruns);
+
+  return 0;
+}
@@ -0,0 +1,190 @@
+/*
+ * followcheck - runs the real follow_segment_aggressive() along a
+ * straight line on the host.
+ *
+ * mazesim.c replaces follow-segment.c with whole-segment stand-ins, so
+ * the fast follower's own timing is never run by mazecheck.  Here it
+ * drives a robot that moves along one straight line at a speed in
+ * proportion to its motor power, a cell every PARAM_FAST_CELL_MS at
+ * full power, with intersections at given distances.  Each case may
+ * knock the robot off the line part way; it stays off until
+ * find_line() has spun for a while.  A case fails if the follower
+ * doesn't stop on the intersection it was sent to, or thinks it
+ * overshot it.
+ *
+ * usage: followcheck
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pololu/3pi.h>
+#include "follow-segment.h"
+#include "motors.h"
+#include "params.h"
+
+#define MAX_PIECES 4
+#define NODE_WIDTH 2  // the side sensors see a crossing line this far either side, in 1/16 cells
+#define SPIN_MS    30 // spinning this long finds a lost line again
+
+void load_params();
+
+typedef struct follow_case
+{
+  const char *name;
+  uint8_t pieces[MAX_PIECES]; // lengths between intersections, in 1/16 cells; 0 ends
+  uint8_t ignore;             // intersections to drive through
+  int16_t skid_at;            // where the robot is knocked off the line; -1 for never
+} follow_case;
+
+const follow_case cases[] = {
+  { "straight through one",            { 48, 48 },     1, -1 },
+  { "skid, then an ignored node",      { 64, 48 },     1, 20 },
+  { "skid just short of an ignored node", { 64, 32 },  1, 56 },
+  { "skid, then two ignored nodes",    { 48, 48, 32 }, 2, 24 },
+  { "skid in the last piece",          { 48, 64 },     1, 70 },
+};
+
+// the virtual robot
+
+unsigned long ticks;
+double distance; // along the line, in 1/16 cells
+int left_power, right_power;
+bool off_line;
+unsigned long spin_ticks;
+const follow_case *current;
+
+// Moves the robot on by the time since it was last moved.
+void advance(unsigned long new_ticks)
+{
+  double ms = (new_ticks - ticks) / 2500.0;
+  ticks = new_ticks;
+
+  if ((left_power > 0) != (right_power > 0))
+  {
+    spin_ticks += ms * 2500;
+    if (spin_ticks >= SPIN_MS * 2500UL)
+      off_line = false;
+    return;
+  }
+
+  double before = distance;
+  distance += ms * (left_power + right_power) / 2 / 255.0 * SEG_LENGTH_SCALE / params[PARAM_FAST_CELL_MS];
+  if (current->skid_at >= 0 && before < current->skid_at && distance >= current->skid_at)
+  {
+    off_line = true;
+    spin_ticks = 0;
+  }
+}
+
+bool at_node()
+{
+  int node = 0;
+
+  for (int i = 0; i < MAX_PIECES && current->pieces[i]; i++)
+  {
+    node += current->pieces[i];
+    if (distance > node - NODE_WIDTH && distance < node + NODE_WIDTH)
+      return true;
+  }
+  return false;
+}
+
+unsigned int read_line(unsigned int *sensor_values, unsigned char read_mode)
+{
+  bool node = at_node();
+
+  sensor_values[0] = sensor_values[4] = node ? 1000 : 0;
+  sensor_values[2] = off_line ? 0 : 1000;
+  sensor_values[1] = sensor_values[3] = off_line ? 0 : 300;
+  return off_line ? 0 : 2000;
+}
+
+void set_motors(int left, int right)
+{
+  advance(ticks);
+  left_power = left;
+  right_power = right;
+}
+
+// every call takes 10 us, so busy waits move the robot on
+unsigned long get_ticks() { advance(ticks + 25); return ticks; }
+unsigned long get_ms() { return get_ticks() / 2500; }
+unsigned long millis() { return get_ms(); }
+void delay_ms(unsigned int milliseconds) { advance(ticks + milliseconds * 2500UL); }
+void delay_us(unsigned int microseconds) {}
+unsigned long ticks_to_microseconds(unsigned long ticks) { return ticks * 2 / 5; }
+
+int read_battery_millivolts() { return NOMINAL_BATTERY_MV; }
+
+// calibrate.c; the virtual sensors need no calibrating
+
+void adapt_calibration(const unsigned int *sensors, unsigned int position) {}
+
+// everything else does nothing
+
+volatile uint8_t PORTD, DDRD, SREG;
+
+void clear() {}
+void print(const char *str) {}
+void print_from_program_space(const char *str) {}
+void print_long(long value) {}
+void print_unsigned_long(unsigned long value) {}
+void print_character(char c) {}
+void lcd_goto_xy(int col, int row) {}
+void lcd_load_custom_character(const char *picture, unsigned char number) {}
+
+void play(const char *sequence) {}
+void play_from_program_space(const char *sequence) {}
+void play_frequency(unsigned int freq, unsigned int duration, unsigned char volume) {}
+void stop_playing() {}
+unsigned char is_playing() { return 0; }
+
+unsigned char button_is_pressed(unsigned char buttons) { return 0; }
+unsigned char wait_for_button(unsigned char buttons) { return buttons & BUTTON_A; }
+unsigned char wait_for_button_press(unsigned char buttons) { return buttons & BUTTON_A; }
+unsigned char wait_for_button_release(unsigned char buttons) { return buttons & BUTTON_A; }
+unsigned char get_single_debounced_button_press(unsigned char buttons) { return 0; }
+
+void set_digital_output(unsigned char pin, unsigned char output_state) {}
+void set_digital_input(unsigned char pin, unsigned char input_state) {}
+
+
+// Sends the robot from the start of the line to the intersection after
+// the ones it is to ignore.  Returns true if it got there and knew it.
+bool check_case(const follow_case *c)
+{
+  int target = 0;
+
+  current = c;
+  distance = 0;
+  off_line = false;
+  left_power = right_power = 0;
+
+  for (int i = 0; i <= c->ignore; i++)
+    target += c->pieces[i];
+
+  uint8_t seen = follow_segment_aggressive(target, c->pieces, c->ignore, 255);
+  bool ok = seen == c->ignore + 1 && !overshot &&
+    distance > target - NODE_WIDTH && distance < target + NODE_WIDTH;
+
+  printf("%-36s %s: %d intersections, stopped at %.1f/16 of %d/16%s\n",
+         c->name, ok ? "ok" : "FAIL", seen, distance, target, overshot ? ", overshot" : "");
+  return ok;
+}
+
+int main(int argc, char **argv)
+{
+  int failures = 0;
+
+  if (argc != 1)
+  {
+    fprintf(stderr, "usage: %s\n", argv[0]);
+    return 2;
+  }
+
+  load_params();
+  for (unsigned int i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    failures += !check_case(&cases[i]);
+
+  return failures ? 1 : 0;
+}
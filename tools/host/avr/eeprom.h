@@ -0,0 +1,24 @@
+/*
+ * Host stand-in for avr-libc's <avr/eeprom.h>: EEMEM variables are
+ * ordinary memory on the host, so reads and writes are plain copies.
+ */
+
+#ifndef __host_avr_eeprom_h
+#define __host_avr_eeprom_h
+
+#include <stdint.h>
+#include <string.h>
+
+#define EEMEM
+
+#define eeprom_read_byte(addr) (*(const uint8_t *)(addr))
+#define eeprom_read_word(addr) (*(const uint16_t *)(addr))
+#define eeprom_write_byte(addr, value) (*(uint8_t *)(addr) = (value))
+#define eeprom_write_word(addr, value) (*(uint16_t *)(addr) = (value))
+#define eeprom_update_byte(addr, value) eeprom_write_byte(addr, value)
+#define eeprom_update_word(addr, value) eeprom_write_word(addr, value)
+#define eeprom_read_block(dst, src, n) memcpy((dst), (src), (n))
+#define eeprom_write_block(src, dst, n) memcpy((dst), (src), (n))
+#define eeprom_update_block(src, dst, n) memcpy((dst), (src), (n))
+
+#endif
@@ -0,0 +1,12 @@
+/*
+ * Host stand-in for avr-libc's <avr/interrupt.h>: there are no
+ * interrupts on the host.
+ */
+
+#ifndef __host_avr_interrupt_h
+#define __host_avr_interrupt_h
+
+#define cli()
+#define sei()
+
+#endif
@@ -0,0 +1,16 @@
+/*
+ * Host stand-in for avr-libc's <avr/pgmspace.h>: program space is just
+ * ordinary memory on the host.
+ */
+
+#ifndef __host_avr_pgmspace_h
+#define __host_avr_pgmspace_h
+
+#include <stdint.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+
+#endif
@@ -0,0 +1,90 @@
+/*
+ * Host stand-in for the Pololu AVR library's 3pi header.
+ *
+ * Only the calls used by this program are declared.  The functions are
+ * implemented by the host tools (see tools/mazesim.c), which model the
+ * robot driving around a virtual maze instead of a real one.
+ */
+
+#ifndef __host_pololu_3pi_h
+#define __host_pololu_3pi_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <avr/pgmspace.h>
+
+#define IR_EMITTERS_ON 1
+#define IR_EMITTERS_OFF 0
+
+#define BUTTON_A 0x02
+#define BUTTON_B 0x10
+#define BUTTON_C 0x20
+#define ANY_BUTTON (BUTTON_A | BUTTON_B | BUTTON_C)
+
+#define IO_D0 0
+#define LOW 0
+#define HIGH 1
+#define TOGGLE 0xFF
+#define HIGH_IMPEDANCE 0
+#define PULL_UP_ENABLED 1
+
+// registers, for code that drives pins directly
+extern volatile uint8_t PORTD, DDRD, SREG;
+#define PD0 0
+
+// cycle-counted delays take no time on the host
+#define __builtin_avr_delay_cycles(cycles) ((void)0)
+
+void pololu_3pi_init(unsigned int line_sensor_timeout);
+
+// line sensors
+unsigned int read_line(unsigned int *sensor_values, unsigned char read_mode);
+void read_line_sensors(unsigned int *sensor_values, unsigned char read_mode);
+void read_line_sensors_calibrated(unsigned int *sensor_values, unsigned char read_mode);
+void calibrate_line_sensors(unsigned char read_mode);
+unsigned int *get_line_sensors_calibrated_minimum_on();
+unsigned int *get_line_sensors_calibrated_maximum_on();
+
+// motors
+void set_motors(int left, int right);
+
+// time
+void delay_ms(unsigned int milliseconds);
+void delay_us(unsigned int microseconds);
+unsigned long get_ms();
+unsigned long millis();
+unsigned long get_ticks();
+unsigned long ticks_to_microseconds(unsigned long ticks);
+
+// LCD
+void clear();
+void print(const char *str);
+void print_from_program_space(const char *str);
+void print_long(long value);
+void print_unsigned_long(unsigned long value);
+void print_character(char c);
+void lcd_goto_xy(int col, int row);
+void lcd_load_custom_character(const char *picture, unsigned char number);
+
+// buzzer
+void play(const char *sequence);
+void play_from_program_space(const char *sequence);
+void play_frequency(unsigned int freq, unsigned int duration, unsigned char volume);
+void stop_playing();
+unsigned char is_playing();
+
+// buttons
+unsigned char button_is_pressed(unsigned char buttons);
+unsigned char wait_for_button(unsigned char buttons);
+unsigned char wait_for_button_press(unsigned char buttons);
+unsigned char wait_for_button_release(unsigned char buttons);
+unsigned char get_single_debounced_button_press(unsigned char buttons);
+
+// analog
+int read_battery_millivolts();
+
+// digital I/O
+void set_digital_output(unsigned char pin, unsigned char output_state);
+void set_digital_input(unsigned char pin, unsigned char input_state);
+
+#endif
@@ -0,0 +1,455 @@
+/*
+ * mapplan - plans a run on the host from a map sent by the robot, and
+ * sends the plan back (see map-format.h and map-link.c).
+ *
+ * The robot plans by counting cells, which is all it has the RAM and
+ * time for.  This looks for the quickest route instead: a Dijkstra
+ * search over cell and heading, where a cell costs its measured length
+ * at full speed and every turn costs the turn itself plus the time lost
+ * braking for it and speeding up again.  Straights too short to reach
+ * full speed and brake again get a lower top speed, so the robot
+ * doesn't overshoot the turn at their end.
+ *
+ * With -d the map is read from the robot's serial port, waiting for the
+ * robot to send one, and the plan is written back to it; otherwise the
+ * map is read from a file and the plan written to -o, if given.
+ *
+ * usage: mapplan [options] (-d device | map_file)
+ *   -o file  write the plan to file
+ *   -c ms    ms per cell at full speed, default 137 (the robot's FastCell)
+ *   -t ms    ms per left or right turn, default 200 (FTurn ms)
+ *   -r ms    ms lost slowing down for a turn and speeding up again,
+ *            default 150
+ *   -b ms    ms to turn around at the start, default 300 (FBack ms)
+ *   -m cells straights shorter than this get the slow speed, default 2
+ *   -s speed top speed for short straights, default 160
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include "map-format.h"
+#include "maze-map.h"
+
+#define MAX_PLAN_LENGTH 255
+
+const int dx[4] = { 0, 1, 0, -1 };
+const int dy[4] = { 1, 0, -1, 0 };
+
+// the map
+int size;
+int start_x, start_y, finish_x, finish_y;
+uint8_t edges[MAX_MAZE_SIZE][MAX_MAZE_SIZE];
+uint8_t trims[MAX_MAZE_SIZE][MAX_MAZE_SIZE];
+
+// costs, in ms
+double cell_ms = 137, turn_ms = 200, restart_ms = 150, back_ms = 300;
+double slow_cells = 2;
+int slow_speed = 160;
+
+// the plan
+char plan_turns[MAX_PLAN_LENGTH];
+uint8_t plan_lengths[MAX_PLAN_LENGTH];
+uint8_t plan_speeds[MAX_PLAN_LENGTH];
+int plan_length;
+
+bool on_map(int x, int y)
+{
+  return x >= 0 && y >= 0 && x < size && y < size;
+}
+
+// Edges are kept on their south or west cell, as on the robot.  A seen
+// exit is a real line the robot will notice, but has never driven.
+uint8_t edge_bits(int x, int y, int d, uint8_t mapped, uint8_t seen)
+{
+  switch (d)
+  {
+  case NORTH: return on_map(x, y) ? edges[x][y] & (mapped | seen) : 0;
+  case EAST:  return on_map(x, y) ? edges[x][y] & ((mapped | seen) << 1) : 0;
+  case SOUTH: return on_map(x, y - 1) ? edges[x][y - 1] & (mapped | seen) : 0;
+  default:    return on_map(x - 1, y) ? edges[x - 1][y] & ((mapped | seen) << 1) : 0;
+  }
+}
+
+bool mapped_exit(int x, int y, int d)
+{
+  return edge_bits(x, y, d, MAP_NORTH_EDGE, 0);
+}
+
+bool any_exit(int x, int y, int d)
+{
+  return edge_bits(x, y, d, MAP_NORTH_EDGE, MAP_NORTH_SEEN);
+}
+
+// in 1/SEG_LENGTH_SCALE cells
+int cell_length(int x, int y, int d)
+{
+  if (d == SOUTH)
+    y--;
+  if (d == WEST)
+    x--;
+
+  uint8_t t = trims[x][y];
+  int trim = (d == NORTH || d == SOUTH) ? (t & 0xf) : (t >> 4);
+  if (trim & 8)
+    trim -= 16; // signed nibble
+  return SEG_LENGTH_SCALE + trim;
+}
+
+bool read_all(int fd, uint8_t *data, size_t length)
+{
+  while (length)
+  {
+    ssize_t n = read(fd, data, length);
+    if (n <= 0)
+      return false;
+    data += n;
+    length -= n;
+  }
+  return true;
+}
+
+bool write_all(int fd, const uint8_t *data, size_t length)
+{
+  while (length)
+  {
+    ssize_t n = write(fd, data, length);
+    if (n <= 0)
+      return false;
+    data += n;
+    length -= n;
+  }
+  return true;
+}
+
+// Reads a map, skipping anything before its 'M' 'Z', so that on a serial
+// port it can be started at any time.
+bool read_map(int fd)
+{
+  uint8_t header[MAP_HEADER_SIZE] = { 0 };
+  uint8_t cells[MAX_MAZE_SIZE * MAX_MAZE_SIZE * 2];
+  uint8_t tail[2];
+  fletcher16 sum = { 0, 0 };
+
+  do
+  {
+    header[0] = header[1];
+    if (!read_all(fd, &header[1], 1))
+      return false;
+  } while (header[0] != 'M' || header[1] != 'Z');
+
+  if (!read_all(fd, &header[2], MAP_HEADER_SIZE - 2))
+    return false;
+  if (header[2] != MAP_FORMAT_VERSION)
+  {
+    fprintf(stderr, "map format version %d, expected %d\n", header[2], MAP_FORMAT_VERSION);
+    return false;
+  }
+
+  size = header[3];
+  start_x = header[4];
+  start_y = header[5];
+  finish_x = header[6];
+  finish_y = header[7];
+  if (size < 1 || size > MAX_MAZE_SIZE || !on_map(start_x, start_y) || !on_map(finish_x, finish_y))
+  {
+    fprintf(stderr, "bad map header\n");
+    return false;
+  }
+
+  if (!read_all(fd, cells, size * size * 2) || !read_all(fd, tail, sizeof(tail)))
+    return false;
+
+  fletcher16_update(&sum, header, MAP_HEADER_SIZE);
+  fletcher16_update(&sum, cells, size * size * 2);
+  if ((tail[0] | (tail[1] << 8)) != fletcher16_value(&sum))
+  {
+    fprintf(stderr, "map checksum mismatch\n");
+    return false;
+  }
+
+  for (int y = 0; y < size; y++)
+  {
+    for (int x = 0; x < size; x++)
+    {
+      edges[x][y] = cells[(y * size + x) * 2];
+      trims[x][y] = cells[(y * size + x) * 2 + 1];
+    }
+  }
+  return true;
+}
+
+// Dijkstra over (x, y, heading), where heading is the way the robot
+// faces on arriving at the cell.  Maps are small enough for the simple
+// O(n^2) version.
+#define STATES (MAX_MAZE_SIZE * MAX_MAZE_SIZE * 4)
+#define state(x, y, d) ((((y) * MAX_MAZE_SIZE) + (x)) * 4 + (d))
+
+double best_ms[STATES];
+int came_from[STATES];
+bool done[STATES];
+
+void reach(int from, int x, int y, int d, double ms)
+{
+  int s = state(x, y, d);
+  if (!done[s] && ms < best_ms[s])
+  {
+    best_ms[s] = ms;
+    came_from[s] = from;
+  }
+}
+
+// Returns the state the finish is reached in, or -1.
+int search()
+{
+  for (int s = 0; s < STATES; s++)
+  {
+    best_ms[s] = 1e30;
+    came_from[s] = -1;
+    done[s] = false;
+  }
+
+  // the robot starts facing north, and may only turn around before it
+  // has set off
+  best_ms[state(start_x, start_y, NORTH)] = 0;
+  if (mapped_exit(start_x, start_y, SOUTH))
+    reach(state(start_x, start_y, NORTH), start_x, start_y, SOUTH, back_ms);
+
+  for (;;)
+  {
+    int s = -1;
+    for (int i = 0; i < STATES; i++)
+    {
+      if (!done[i] && best_ms[i] < 1e30 && (s < 0 || best_ms[i] < best_ms[s]))
+        s = i;
+    }
+    if (s < 0)
+      return -1;
+    done[s] = true;
+
+    int d = s & 3;
+    int x = (s >> 2) % MAX_MAZE_SIZE;
+    int y = (s >> 2) / MAX_MAZE_SIZE;
+    if (x == finish_x && y == finish_y)
+      return s;
+
+    // straight on, then left and right, each into the next cell
+    int dirs[3] = { d, left_of(d), right_of(d) };
+    for (int i = 0; i < 3; i++)
+    {
+      int nd = dirs[i];
+      if (!mapped_exit(x, y, nd))
+        continue;
+
+      double ms = best_ms[s] + cell_length(x, y, nd) * cell_ms / SEG_LENGTH_SCALE;
+      if (nd != d)
+        ms += turn_ms + restart_ms;
+      reach(s, x + dx[nd], y + dy[nd], nd, ms);
+    }
+  }
+}
+
+void add_plan_step(char turn, int length)
+{
+  if (plan_length >= MAX_PLAN_LENGTH)
+    return;
+  plan_turns[plan_length] = turn;
+  plan_lengths[plan_length] = length > UINT8_MAX ? UINT8_MAX : length;
+  plan_speeds[plan_length] = 0;
+  plan_length++;
+}
+
+// Walks the route from the start, in the path format the robot builds
+// itself: a length and a turn at each node where the route turns, and
+// an 'S' at each node it passes straight through.
+void build_plan(int finish_state)
+{
+  int route[STATES], route_length = 0;
+
+  for (int s = finish_state; s >= 0; s = came_from[s])
+    route[route_length++] = s;
+
+  plan_length = 0;
+  int seg_length = 0;       // since the last entry
+  int straight_length = 0;  // since the last turn
+
+  for (int i = route_length - 1; i > 0; i--)
+  {
+    int s = route[i], next = route[i - 1];
+    int d = s & 3, nd = next & 3;
+    int x = (s >> 2) % MAX_MAZE_SIZE;
+    int y = (s >> 2) / MAX_MAZE_SIZE;
+    char turn = 0;
+
+    if ((next >> 2) == (s >> 2))
+      turn = 'B'; // turned around on the spot, at the start
+    else if (nd == left_of(d))
+      turn = 'L';
+    else if (nd == right_of(d))
+      turn = 'R';
+    else if (any_exit(x, y, left_of(d)) || any_exit(x, y, right_of(d)))
+      turn = 'S';
+
+    if (turn)
+    {
+      add_plan_step(turn, seg_length);
+      seg_length = 0;
+    }
+    if (turn && turn != 'S')
+    {
+      if (straight_length && straight_length < slow_cells * SEG_LENGTH_SCALE)
+        plan_speeds[plan_length - 1] = slow_speed;
+      straight_length = 0;
+    }
+
+    if ((next >> 2) != (s >> 2))
+    {
+      seg_length += cell_length(x, y, nd);
+      straight_length += cell_length(x, y, nd);
+    }
+  }
+
+  // the last straight runs into the finish, which the robot doesn't
+  // brake for
+  add_plan_step('X', seg_length);
+}
+
+bool write_plan(int fd)
+{
+  uint8_t header[PLAN_HEADER_SIZE] = { 'P', 'L', PLAN_FORMAT_VERSION, plan_length };
+  fletcher16 sum = { 0, 0 };
+
+  fletcher16_update(&sum, header, sizeof(header));
+  fletcher16_update(&sum, (uint8_t *)plan_turns, plan_length);
+  fletcher16_update(&sum, plan_lengths, plan_length);
+  fletcher16_update(&sum, plan_speeds, plan_length);
+  uint16_t value = fletcher16_value(&sum);
+  uint8_t tail[2] = { value & 0xff, value >> 8 };
+
+  return write_all(fd, header, sizeof(header)) &&
+    write_all(fd, (uint8_t *)plan_turns, plan_length) &&
+    write_all(fd, plan_lengths, plan_length) &&
+    write_all(fd, plan_speeds, plan_length) &&
+    write_all(fd, tail, sizeof(tail));
+}
+
+int open_serial(const char *device)
+{
+  int fd = open(device, O_RDWR | O_NOCTTY);
+  if (fd < 0)
+    return -1;
+
+  struct termios tio;
+  if (tcgetattr(fd, &tio) < 0)
+  {
+    close(fd);
+    return -1;
+  }
+  cfmakeraw(&tio);
+  cfsetispeed(&tio, B38400); // MAP_BAUD_RATE
+  cfsetospeed(&tio, B38400);
+  tio.c_cc[VMIN] = 1;
+  tio.c_cc[VTIME] = 0;
+  if (tcsetattr(fd, TCSANOW, &tio) < 0)
+  {
+    close(fd);
+    return -1;
+  }
+  tcflush(fd, TCIFLUSH);
+  return fd;
+}
+
+int main(int argc, char **argv)
+{
+  const char *device = NULL, *plan_file = NULL;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "d:o:c:t:r:b:m:s:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'd': device = optarg; break;
+    case 'o': plan_file = optarg; break;
+    case 'c': cell_ms = atof(optarg); break;
+    case 't': turn_ms = atof(optarg); break;
+    case 'r': restart_ms = atof(optarg); break;
+    case 'b': back_ms = atof(optarg); break;
+    case 'm': slow_cells = atof(optarg); break;
+    case 's': slow_speed = atoi(optarg); break;
+    default:
+      goto usage;
+    }
+  }
+  if ((device != NULL) == (argc - optind == 1) || argc - optind > 1)
+  {
+  usage:
+    fprintf(stderr, "usage: %s [-o plan_file] [-c cell_ms] [-t turn_ms] [-r restart_ms] [-b back_ms]\n"
+      "  [-m slow_cells] [-s slow_speed] (-d device | map_file)\n", argv[0]);
+    return 2;
+  }
+
+  const char *map_source = device ? device : argv[optind];
+  int fd = device ? open_serial(device) : open(map_source, O_RDONLY);
+  if (fd < 0)
+  {
+    perror(map_source);
+    return 1;
+  }
+
+  if (device)
+    fprintf(stderr, "waiting for a map on %s\n", device);
+  if (!read_map(fd))
+  {
+    fprintf(stderr, "%s: no valid map\n", map_source);
+    return 1;
+  }
+
+  int finish_state = search();
+  if (finish_state < 0)
+  {
+    fprintf(stderr, "no route from (%d, %d) to (%d, %d)\n", start_x, start_y, finish_x, finish_y);
+    return 1;
+  }
+  build_plan(finish_state);
+
+  if (plan_length >= MAX_PLAN_LENGTH)
+  {
+    fprintf(stderr, "route too long for a plan\n");
+    return 1;
+  }
+
+  printf("%.0f ms, %d steps:", best_ms[finish_state], plan_length);
+  for (int i = 0; i < plan_length; i++)
+  {
+    printf(" %c%.1f", plan_turns[i], (double)plan_lengths[i] / SEG_LENGTH_SCALE);
+    if (plan_speeds[i])
+      printf("@%d", plan_speeds[i]);
+  }
+  printf("\n");
+
+  int out = -1;
+  if (device)
+    out = fd;
+  else if (plan_file)
+  {
+    out = open(plan_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0)
+    {
+      perror(plan_file);
+      return 1;
+    }
+  }
+
+  if (out >= 0 && !write_plan(out))
+  {
+    perror(device ? device : plan_file);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,373 @@
+/*
+ * mazebench - times the mapping and planning functions of maze-map.c
+ * on fixed synthetic maps and compares them with a baseline.
+ *
+ * The benchmarks are:
+ *
+ *   update_map        a serpentine of segments, before the finish is known
+ *   update_map_plan   the same after the finish is known, including the
+ *                     background planning each segment queues
+ *   update_map_shift  one segment off each edge of the map, so that every
+ *                     shift_map_*() runs
+ *   select_turn       every combination of marks and exits
+ *   fill_all_costs    a full grid with the finish in the far corner
+ *   build_path        the same grid, start to finish
+ *
+ * Each is run REPEATS times and the fastest mean is kept, which is far
+ * steadier from run to run than the average.  Host ns would only mean
+ * something on the machine that wrote the baseline, so every time is
+ * given as a multiple of the time of a reference loop that doesn't use
+ * the maze code, timed in the same run.  A faster or slower host moves
+ * both together.  With -w the baseline is rewritten instead of checked.
+ *
+ * usage: mazebench [-t tolerance_percent] [-w] baseline
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <getopt.h>
+#include "maze-map.h"
+#include "mazesim.h"
+#include "params.h"
+#include "scheduler.h"
+
+#define REPEATS 15
+#define ITERATIONS 200
+
+// the full grid used for planning, in map coordinates
+#define GRID_LOW 2
+#define GRID_HIGH (MAZE_SIZE - 3)
+
+typedef struct bench
+{
+  const char *name;
+  void (*setup)();
+  void (*run)();
+  unsigned int calls; // per run()
+} bench;
+
+volatile long sink; // keeps results from being optimized away
+
+// the reference: sweeps costs across a grid the size of the map, with
+// the same byte loads, compares and stores as the planner
+
+uint8_t reference_grid[MAZE_SIZE][MAZE_SIZE];
+
+void setup_reference()
+{
+  memset(reference_grid, 0xFF, sizeof(reference_grid));
+  reference_grid[0][0] = 0;
+}
+
+void run_reference()
+{
+  for (uint8_t pass = 0; pass < 2; pass++)
+  {
+    for (uint8_t y = 0; y < MAZE_SIZE; y++)
+    {
+      for (uint8_t x = 0; x < MAZE_SIZE; x++)
+      {
+        uint8_t cost = reference_grid[x][y];
+        if (x > 0 && reference_grid[x - 1][y] + 1 < cost)
+          cost = reference_grid[x - 1][y] + 1;
+        if (y > 0 && reference_grid[x][y - 1] + 1 < cost)
+          cost = reference_grid[x][y - 1] + 1;
+        reference_grid[x][y] = cost;
+      }
+    }
+  }
+  sink = reference_grid[MAZE_SIZE - 1][MAZE_SIZE - 1];
+}
+
+// Adds the edge leaving (x, y) in direction d.
+void add_edge(int8_t x, int8_t y, uint8_t d)
+{
+  here = (pos){ x, y };
+  dir = d;
+  update_map(1, 0);
+}
+
+// update_map
+
+#define SERPENTINE_ROWS 6
+
+void setup_serpentine()
+{
+  clear_map();
+  recorded_finish = false;
+  start = here = (pos){ GRID_LOW, GRID_LOW };
+}
+
+void run_serpentine()
+{
+  // up a column, across, down the next and so on
+  for (uint8_t i = 0; i < SERPENTINE_ROWS; i++)
+  {
+    dir = (i & 1) ? SOUTH : NORTH;
+    update_map(GRID_HIGH - GRID_LOW, 0);
+    dir = EAST;
+    update_map(1, 0);
+  }
+}
+
+void setup_serpentine_plan()
+{
+  setup_serpentine();
+
+  // a finish beside the start, so every segment lowers costs
+  add_edge(GRID_LOW, GRID_LOW, WEST);
+  finish = here;
+  recorded_finish = true;
+  fill_all_costs();
+  here = start;
+}
+
+void run_serpentine_plan()
+{
+  run_serpentine();
+  finish_background();
+}
+
+void setup_shift()
+{
+  clear_map();
+  recorded_finish = false;
+  start = here = (pos){ MAZE_SIZE / 2, MAZE_SIZE / 2 };
+}
+
+void run_shift()
+{
+  for (uint8_t d = 0; d < 4; d++)
+  {
+    // far enough past the centre to leave the map
+    dir = d;
+    update_map(MAZE_SIZE / 2 + 1, 0);
+  }
+}
+
+// select_turn
+
+void setup_nothing() {}
+
+void run_select_turn()
+{
+  long total = 0;
+
+  for (uint8_t d = 0; d < 4; d++)
+  {
+    dir = d;
+    for (uint16_t marks = 0; marks < 81; marks++)
+    {
+      uint16_t m = marks;
+      for (uint8_t i = 0; i < 4; i++, m /= 3)
+        dir_marks[i] = m % 3;
+
+      for (uint8_t exits = 0; exits < 8; exits++)
+      {
+        found_left = exits & 1;
+        found_straight = exits & 2;
+        found_right = exits & 4;
+        total += select_turn();
+      }
+    }
+  }
+  sink = total;
+}
+
+// planning on a full grid
+
+void setup_grid()
+{
+  clear_map();
+  recorded_finish = false;
+
+  for (int8_t y = GRID_LOW; y <= GRID_HIGH; y++)
+  {
+    for (int8_t x = GRID_LOW; x <= GRID_HIGH; x++)
+    {
+      if (x < GRID_HIGH)
+        add_edge(x, y, EAST);
+      if (y < GRID_HIGH)
+        add_edge(x, y, NORTH);
+    }
+  }
+
+  start = (pos){ GRID_LOW, GRID_LOW };
+  finish = (pos){ GRID_HIGH, GRID_HIGH };
+  recorded_finish = true;
+}
+
+void setup_grid_costs()
+{
+  setup_grid();
+  fill_all_costs();
+}
+
+void run_fill_all_costs()
+{
+  fill_all_costs();
+}
+
+void run_build_path()
+{
+  build_path();
+}
+
+bench benches[] = {
+  { "update_map",       setup_serpentine,      run_serpentine,      SERPENTINE_ROWS * 2 },
+  { "update_map_plan",  setup_serpentine_plan, run_serpentine_plan, SERPENTINE_ROWS * 2 },
+  { "update_map_shift", setup_shift,           run_shift,           4 },
+  { "select_turn",      setup_nothing,         run_select_turn,     4 * 81 * 8 },
+  { "fill_all_costs",   setup_grid,            run_fill_all_costs,  1 },
+  { "build_path",       setup_grid_costs,      run_build_path,      1 },
+};
+
+#define BENCH_COUNT (sizeof(benches) / sizeof(benches[0]))
+
+const bench reference = { "reference", setup_reference, run_reference, 1 };
+
+double now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Times one call of setup() and run(), returning ns per call.
+double time_call(const bench *b)
+{
+  b->setup();
+  double t0 = now_ns();
+  b->run();
+  return (now_ns() - t0) / b->calls;
+}
+
+// Returns the time per call of the fastest repeat, in multiples of the
+// reference.  Each call is timed next to a call of the reference loop,
+// so that the host speeding up or slowing down part way through moves
+// both.  The fastest reference repeat goes in *reference_ns.
+double time_bench(const bench *b, double *reference_ns)
+{
+  double best = 1e30, best_reference = 1e30;
+
+  for (int r = 0; r < REPEATS; r++)
+  {
+    double total = 0, reference_total = 0;
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+      reference_total += time_call(&reference);
+      total += time_call(b);
+    }
+
+    if (total < best)
+      best = total;
+    if (reference_total < best_reference)
+      best_reference = reference_total;
+  }
+
+  *reference_ns = best_reference / ITERATIONS;
+  return best / best_reference;
+}
+
+// Returns the baseline for name, in reference loops, or 0 if it has none.
+double baseline_for(FILE *f, const char *name)
+{
+  char line[128], n[64];
+  double ns;
+
+  rewind(f);
+  while (fgets(line, sizeof(line), f))
+  {
+    if (line[0] != '#' && sscanf(line, "%63s %lf", n, &ns) == 2 && !strcmp(n, name))
+      return ns;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  double tolerance = 25;
+  bool write = false;
+  double results[BENCH_COUNT];
+  int opt;
+
+  while ((opt = getopt(argc, argv, "t:w")) != -1)
+  {
+    switch (opt)
+    {
+    case 't': tolerance = atof(optarg); break;
+    case 'w': write = true; break;
+    default:
+      goto usage;
+    }
+  }
+  if (argc - optind != 1)
+  {
+  usage:
+    fprintf(stderr, "usage: %s [-t tolerance_percent] [-w] baseline\n", argv[0]);
+    return 2;
+  }
+
+  load_params();
+
+  // the virtual maze isn't driven, but sim_restart() needs one
+  static sim_maze empty;
+  sim_load(&empty, 0);
+
+  double reference_ns = 1e30;
+  for (unsigned int i = 0; i < BENCH_COUNT; i++)
+  {
+    double ns;
+    results[i] = time_bench(&benches[i], &ns);
+    if (ns < reference_ns)
+      reference_ns = ns;
+  }
+
+  if (write)
+  {
+    FILE *f = fopen(argv[optind], "w");
+    if (!f)
+    {
+      perror(argv[optind]);
+      return 1;
+    }
+    fprintf(f, "# mazebench time per call in reference loops, MAZE_SIZE %d; rewrite with \"make bench-baseline\"\n", MAZE_SIZE);
+    for (unsigned int i = 0; i < BENCH_COUNT; i++)
+      fprintf(f, "%s %.5f\n", benches[i].name, results[i]);
+    fclose(f);
+    return 0;
+  }
+
+  FILE *f = fopen(argv[optind], "r");
+  if (!f)
+  {
+    perror(argv[optind]);
+    return 1;
+  }
+
+  int regressions = 0;
+  printf("reference loop %.1f ns\n", reference_ns);
+  printf("%-18s %10s %10s %8s\n", "benchmark", "baseline", "refs/call", "change");
+  for (unsigned int i = 0; i < BENCH_COUNT; i++)
+  {
+    double base = baseline_for(f, benches[i].name);
+    if (!base)
+    {
+      printf("%-18s %10s %10.5f\n", benches[i].name, "-", results[i]);
+      continue;
+    }
+
+    double change = (results[i] - base) * 100 / base;
+    bool regressed = change > tolerance;
+    printf("%-18s %10.5f %10.5f %+7.1f%%%s\n", benches[i].name, base, results[i], change,
+      regressed ? "  REGRESSION" : "");
+    regressions += regressed;
+  }
+  fclose(f);
+
+  return regressions ? 1 : 0;
+}
@@ -0,0 +1,805 @@
+/*
+ * mazecheck - exhaustively checks the mapping logic on small mazes.
+ *
+ * Every connected maze with at least one loop that fits in a W x H grid
+ * is enumerated, and for every choice of start and finish the real
+ * map_maze(), build_path() and run_maze_conservative() are run against
+ * it in the virtual maze from mazesim.c.  A run fails if
+ *
+ *   - mapping doesn't terminate,
+ *   - the robot drives where there is no line,
+ *   - mapping ends somewhere other than the start ('X'),
+ *   - the finish is missed or recorded in the wrong place,
+ *   - an edge is driven more times than its 2-bit marks can count,
+ *   - replaying the path doesn't end on the finish,
+ *   - the path is longer than the shortest route,
+ *   - the path's segment lengths aren't the maze's to the 1/16 cell,
+ *   - timing jitter of more than half a cell makes the conservative
+ *     run change the map,
+ *   - two laps of lap mode don't end back on the start with the same
+ *     path,
+ *   - mapping again doesn't recognise the maze and come back to the
+ *     start with the same path and segment lengths, or
+ *   - after the maze is changed under the mapped robot, the runs don't
+ *     reach the finish or the repaired path isn't the new shortest one.
+ *
+ * The changes are removing the first edge the conservative run drove
+ * that still leaves a way to the finish, and adding the first missing
+ * edge next to the conservative run's route.
+ *
+ * Every edge is up to 1/16 cell longer or shorter than a whole cell,
+ * differently from edge to edge and maze to maze, so the lengths the
+ * robot keeps have something to get wrong.
+ *
+ * The mean virtual time mapping took is printed too, to compare
+ * changes to the exploration.
+ *
+ * The robot always starts on a dead end facing north and the finish is
+ * another dead end, as in a standard line maze.  Mazes are deduplicated
+ * by translation (they must touch all four sides of the grid) and by
+ * rotation (the start must face north); mirror images are kept, since
+ * the exploration order isn't mirror symmetric.
+ *
+ * The search tree is split into prefixes which worker processes pull
+ * from a shared counter, so all cores stay busy however unevenly the
+ * pruning cuts the tree.
+ *
+ * By default every loop count is checked, which a W x H grid caps at
+ * (W - 1) * (H - 1); -l limits it, to check bigger grids in less time.
+ *
+ * usage: mazecheck [-w width] [-h height] [-l max_loops] [-j jobs] [-r max_reports]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "maze-map.h"
+#include "maze-solve.h"
+#include "mazesim.h"
+#include "params.h"
+#include "profiles.h"
+
+#define MAX_NODES 32 // edge bits must fit in a uint64_t
+#define PREFIX_NODES 7
+
+
+// failure categories
+
+enum
+{
+  FAIL_NONTERMINATION,
+  FAIL_OFF_LINE,
+  FAIL_NOT_AT_START,
+  FAIL_WRONG_FINISH,
+  FAIL_MARK_OVERFLOW,
+  FAIL_PATH_MISSES_FINISH,
+  FAIL_SUBOPTIMAL_PATH,
+  FAIL_LENGTHS,
+  FAIL_JITTER,
+  FAIL_LAPS,
+  FAIL_RECALL,
+  FAIL_RECALLED_LENGTHS,
+  FAIL_OVERSHOOT,
+  FAIL_DETOUR_MISSES_FINISH,
+  FAIL_DETOUR_SUBOPTIMAL,
+  FAIL_COUNT
+};
+
+const char *const fail_names[FAIL_COUNT] = {
+  "non-termination",
+  "drove off the line",
+  "mapping ended away from start",
+  "wrong finish",
+  "mark overflow",
+  "path misses finish",
+  "suboptimal path",
+  "segment lengths wrong",
+  "jitter changed the map",
+  "laps don't end at start",
+  "recalled maze run wrong",
+  "recalled lengths wrong",
+  "overshoot not recovered",
+  "detour misses finish",
+  "suboptimal path after detour",
+};
+
+typedef struct shared
+{
+  long next_task;
+  long mazes, runs;
+  long failures[FAIL_COUNT];
+  long reports;
+  long mapped, map_ms; // virtual time spent mapping, over the mazes mapped
+  long recalled, recall_ms; // the same for mapping again from a profile
+} shared;
+
+shared *results;
+
+int width = 4, height = 4, max_loops = -1, max_reports = 10; // -1: no limit
+int node_count, prefix_nodes;
+
+
+// enumeration state: a union-find over the nodes touched so far, with
+// the number of nodes in each component that may still gain edges
+
+typedef struct enum_state
+{
+  uint64_t edges; // bit 2*i: north edge of node i, bit 2*i+1: east edge
+  uint8_t parent[MAX_NODES];
+  uint8_t open[MAX_NODES];
+  uint8_t degree[MAX_NODES];
+  bool touched[MAX_NODES];
+  uint8_t components, loops;
+} enum_state;
+
+uint8_t find(enum_state *s, uint8_t i)
+{
+  while (s->parent[i] != i)
+    i = s->parent[i];
+  return i;
+}
+
+void touch(enum_state *s, uint8_t i)
+{
+  if (!s->touched[i])
+  {
+    s->touched[i] = true;
+    s->parent[i] = i;
+    s->open[i] = 1;
+    s->components++;
+  }
+}
+
+void add_edge(enum_state *s, uint8_t a, uint8_t b)
+{
+  touch(s, a);
+  touch(s, b);
+  s->degree[a]++;
+  s->degree[b]++;
+
+  uint8_t ra = find(s, a), rb = find(s, b);
+  if (ra == rb)
+  {
+    s->loops++;
+  }
+  else
+  {
+    s->parent[rb] = ra;
+    s->open[ra] += s->open[rb];
+    s->components--;
+  }
+}
+
+
+// checking one maze
+
+void print_maze(FILE *f, const sim_maze *m)
+{
+  for (int y = m->height - 1; y >= 0; y--)
+  {
+    for (int x = 0; x < m->width; x++)
+    {
+      char c = 'o';
+      if (x == m->start_x && y == m->start_y)
+        c = 'S';
+      else if (x == m->finish_x && y == m->finish_y)
+        c = 'F';
+      fputc(c, f);
+      if (x < m->width - 1)
+        fputc((m->edges[x][y] & SIM_EAST_EDGE) ? '-' : ' ', f);
+    }
+    fputc('\n', f);
+
+    if (y > 0)
+    {
+      for (int x = 0; x < m->width; x++)
+        fprintf(f, "%c ", (m->edges[x][y - 1] & SIM_NORTH_EDGE) ? '|' : ' ');
+      fputc('\n', f);
+    }
+  }
+}
+
+void report(const sim_maze *m, int failure)
+{
+  __atomic_fetch_add(&results->failures[failure], 1, __ATOMIC_RELAXED);
+
+  if (__atomic_fetch_add(&results->reports, 1, __ATOMIC_RELAXED) >= max_reports)
+    return;
+
+  char buf[1024];
+  FILE *f = fmemopen(buf, sizeof(buf), "w");
+  fprintf(f, "FAIL: %s\n", fail_names[failure]);
+  print_maze(f, m);
+  fputc('\n', f);
+  long n = ftell(f);
+  fclose(f);
+  write(STDOUT_FILENO, buf, n); // one write, so reports don't interleave
+}
+
+uint8_t maze_exits(const sim_maze *m, int8_t x, int8_t y)
+{
+  uint8_t exits = 0;
+  
+  if (m->edges[x][y] & SIM_NORTH_EDGE)
+    exits |= 1 << NORTH;
+  if (m->edges[x][y] & SIM_EAST_EDGE)
+    exits |= 1 << EAST;
+  if (y > 0 && (m->edges[x][y - 1] & SIM_NORTH_EDGE))
+    exits |= 1 << SOUTH;
+  if (x > 0 && (m->edges[x - 1][y] & SIM_EAST_EDGE))
+    exits |= 1 << WEST;
+    
+  return exits;
+}
+
+int shortest_distance(const sim_maze *m)
+{
+  int8_t queue[MAX_NODES][2];
+  int dist[SIM_MAX_SIZE][SIM_MAX_SIZE];
+  int head = 0, tail = 0;
+
+  for (int x = 0; x < SIM_MAX_SIZE; x++)
+    for (int y = 0; y < SIM_MAX_SIZE; y++)
+      dist[x][y] = -1;
+
+  dist[m->start_x][m->start_y] = 0;
+  queue[tail][0] = m->start_x;
+  queue[tail][1] = m->start_y;
+  tail++;
+
+  while (head < tail)
+  {
+    int8_t x = queue[head][0], y = queue[head][1];
+    head++;
+
+    uint8_t exits = maze_exits(m, x, y);
+    for (uint8_t d = NORTH; d <= WEST; d++)
+    {
+      if (!(exits & (1 << d)))
+        continue;
+      int8_t nx = x + (d == EAST) - (d == WEST);
+      int8_t ny = y + (d == NORTH) - (d == SOUTH);
+      if (dist[nx][ny] < 0)
+      {
+        dist[nx][ny] = dist[x][y] + 1;
+        queue[tail][0] = nx;
+        queue[tail][1] = ny;
+        tail++;
+      }
+    }
+  }
+
+  return dist[m->finish_x][m->finish_y];
+}
+
+// the edges driven in the last conservative run, for check_detours()
+uint8_t driven[SIM_MAX_SIZE][SIM_MAX_SIZE][2];
+
+unsigned int path_cells()
+{
+  unsigned int cells = 0;
+  for (uint8_t i = 0; i < path_length; i++)
+    cells += (path_seg_lengths[i] + SEG_LENGTH_SCALE / 2) / SEG_LENGTH_SCALE; // the trims don't add up to whole cells
+  return cells;
+}
+
+// True if each segment of the path is as long as the edges it drives
+// over, trims and all, and so are the map's trims along it.  The path's
+// own rounded lengths say how many cells to walk, so a length that is a
+// cell out shows up too.
+bool path_lengths_match(const sim_maze *m)
+{
+  int8_t x = m->start_x, y = m->start_y;
+  uint8_t d = NORTH;
+  
+  for (uint8_t i = 0; i < path_length; i++)
+  {
+    int cells = (path_seg_lengths[i] + SEG_LENGTH_SCALE / 2) / SEG_LENGTH_SCALE;
+    int length = 0, map_length = 0;
+    
+    for (; cells; cells--)
+    {
+      if (!(maze_exits(m, x, y) & (1 << d)))
+        return false;
+      int8_t nx = x + (d == EAST) - (d == WEST);
+      int8_t ny = y + (d == NORTH) - (d == SOUTH);
+      length += SEG_LENGTH_SCALE + ((d == NORTH || d == SOUTH) ? m->trims[x][d == NORTH ? y : ny][0] : m->trims[d == EAST ? x : nx][y][1]);
+      map_length += SEG_LENGTH_SCALE + get_exit_trim(start.x + x - m->start_x, start.y + y - m->start_y, d);
+      x = nx;
+      y = ny;
+    }
+    if (length != path_seg_lengths[i] || length != map_length)
+      return false;
+    
+    if (path[i] == 'L')
+      d = (d + 3) & 3;
+    else if (path[i] == 'R')
+      d = (d + 1) & 3;
+    else if (path[i] == 'B')
+      d = (d + 2) & 3;
+  }
+  return true;
+}
+
+// Runs the fast and then the conservative run in a changed copy of the
+// maze, keeping the map from the original.  Returns false on a failure.
+bool check_changed_run(const sim_maze *m, const sim_maze *changed, int edge_count, bool aggressive_first)
+{
+  sim_load(changed, 4 * edge_count + 16);
+
+  if (aggressive_first)
+    run_maze_aggressive();
+  else
+    run_maze_conservative();
+  if (!sim_at_finish())
+  {
+    report(changed, FAIL_DETOUR_MISSES_FINISH);
+    return false;
+  }
+
+  sim_restart();
+  if (aggressive_first)
+    run_maze_conservative();
+  else
+    run_maze_aggressive();
+  if (!sim_at_finish())
+  {
+    report(changed, FAIL_DETOUR_MISSES_FINISH);
+    return false;
+  }
+  
+  return true;
+}
+
+bool is_straight(uint8_t exits)
+{
+  return exits == ((1 << NORTH) | (1 << SOUTH)) || exits == ((1 << EAST) | (1 << WEST));
+}
+
+void check_detours(const sim_maze *m, int edge_count)
+{
+  sim_maze changed = *m;
+  bool removed = false, aggressive_first = true;
+  
+  // Block the route.  The map has every other edge, so the repaired path
+  // must be the shortest route through the changed maze.  The fast runs
+  // only notice dead ends, so if the block leaves a straight line where
+  // the route used to turn, the conservative run has to go first.
+  for (int x = 0; x < m->width && !removed; x++)
+  {
+    for (int y = 0; y < m->height && !removed; y++)
+    {
+      for (int e = 0; e < 2 && !removed; e++)
+      {
+        if (!driven[x][y][e])
+          continue;
+        changed.edges[x][y] &= ~(1 << e);
+        removed = shortest_distance(&changed) >= 0;
+        if (!removed)
+          changed.edges[x][y] |= 1 << e;
+        else
+          aggressive_first = !is_straight(maze_exits(&changed, x, y)) && !is_straight(maze_exits(&changed, x + e, y + !e));
+      }
+    }
+  }
+  
+  if (removed)
+  {
+    if (!check_changed_run(m, &changed, edge_count, aggressive_first))
+      return;
+    if (path_cells() != shortest_distance(&changed))
+    {
+      report(&changed, FAIL_DETOUR_SUBOPTIMAL);
+      return;
+    }
+  }
+  
+  // tape down a new line next to the route; it's only ever seen, not
+  // mapped, so the conservative run has to go first to find it
+  changed = *m;
+  for (int x = 0; x < m->width; x++)
+  {
+    for (int y = 0; y < m->height; y++)
+    {
+      for (int e = 0; e < 2; e++)
+      {
+        int nx = x + e, ny = y + !e;
+        if ((changed.edges[x][y] & (1 << e)) || nx >= m->width || ny >= m->height)
+          continue;
+        if (!maze_exits(m, x, y) || !maze_exits(m, nx, ny))
+          continue;
+        if (!(driven[x][y][0] || driven[x][y][1] || driven[nx][ny][0] || driven[nx][ny][1]))
+          continue;
+        if ((x == m->finish_x && y == m->finish_y) || (nx == m->finish_x && ny == m->finish_y) ||
+            (x == m->start_x && y == m->start_y) || (nx == m->start_x && ny == m->start_y))
+          continue;
+          
+        changed.edges[x][y] |= 1 << e;
+        check_changed_run(m, &changed, edge_count, false);
+        return;
+      }
+    }
+  }
+}
+
+void check_run(const sim_maze *m, int edge_count)
+{
+  __atomic_fetch_add(&results->runs, 1, __ATOMIC_RELAXED);
+
+  sim_load(m, 4 * edge_count + 8);
+  path_length = 0;
+  clear_profiles(); // every maze is new to the robot
+
+  if (setjmp(sim.abort))
+  {
+    report(m, (sim.failure == SIM_NONTERMINATION) ? FAIL_NONTERMINATION : FAIL_OFF_LINE);
+    return;
+  }
+
+  map_maze();
+  unsigned long map_ms = sim.ms;
+  __atomic_fetch_add(&results->mapped, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&results->map_ms, map_ms, __ATOMIC_RELAXED);
+
+  if (sim.x != m->start_x || sim.y != m->start_y)
+  {
+    report(m, FAIL_NOT_AT_START);
+    return;
+  }
+
+  if (!recorded_finish ||
+      (finish.x - start.x) != (m->finish_x - m->start_x) ||
+      (finish.y - start.y) != (m->finish_y - m->start_y))
+  {
+    report(m, FAIL_WRONG_FINISH);
+    return;
+  }
+
+  for (int x = 0; x < m->width; x++)
+  {
+    for (int y = 0; y < m->height; y++)
+    {
+      if (sim.traversals[x][y][0] > 3 || sim.traversals[x][y][1] > 3)
+      {
+        report(m, FAIL_MARK_OVERFLOW);
+        return;
+      }
+    }
+  }
+
+  // the conservative run times its segments badly, but the maze hasn't
+  // changed, so it must find everything where the map has it
+  static uint8_t map_edges[MAZE_SIZE][MAZE_SIZE];
+  for (int x = 0; x < MAZE_SIZE; x++)
+    for (int y = 0; y < MAZE_SIZE; y++)
+      map_edges[x][y] = get_map_edges(x, y);
+
+  sim_restart();
+  sim.segments = 0;
+  sim.jitter = SEG_LENGTH_SCALE * 5 / 8;
+  memcpy(driven, sim.traversals, sizeof(driven));
+  run_maze_conservative();
+  sim.jitter = 0;
+
+  if (!sim_at_finish())
+  {
+    report(m, FAIL_PATH_MISSES_FINISH);
+    return;
+  }
+
+  for (int x = 0; x < MAZE_SIZE; x++)
+  {
+    for (int y = 0; y < MAZE_SIZE; y++)
+    {
+      if (get_map_edges(x, y) != map_edges[x][y])
+      {
+        report(m, FAIL_JITTER);
+        return;
+      }
+    }
+  }
+
+  if (path_cells() != shortest_distance(m))
+  {
+    report(m, FAIL_SUBOPTIMAL_PATH);
+    return;
+  }
+
+  if (!path_lengths_match(m))
+  {
+    report(m, FAIL_LENGTHS);
+    return;
+  }
+
+  for (int x = 0; x < m->width; x++)
+    for (int y = 0; y < m->height; y++)
+      for (int e = 0; e < 2; e++)
+        driven[x][y][e] = sim.traversals[x][y][e] - driven[x][y][e];
+
+  // lap mode checks the button after each run, so this is two laps
+  sim_restart();
+  sim.segments = 0;
+  sim.button_polls = 4;
+  run_laps();
+  sim.button_polls = 0;
+
+  if (sim.x != m->start_x || sim.y != m->start_y || path_cells() != shortest_distance(m))
+  {
+    report(m, FAIL_LAPS);
+    return;
+  }
+
+  // map it again: once mapping has gone far enough to recognise the
+  // profile saved the first time, it should drive back to the start
+  // with the same map and path
+  sim_restart();
+  sim.segments = 0;
+  unsigned long remap_start_ms = sim.ms;
+  map_maze();
+  unsigned long remap_ms = sim.ms - remap_start_ms;
+  if (remap_ms < map_ms)
+  {
+    __atomic_fetch_add(&results->recalled, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&results->recall_ms, remap_ms, __ATOMIC_RELAXED);
+  }
+
+  if (sim.x != m->start_x || sim.y != m->start_y || dir != NORTH || !recorded_finish ||
+      (finish.x - start.x) != (m->finish_x - m->start_x) ||
+      (finish.y - start.y) != (m->finish_y - m->start_y) ||
+      path_cells() != shortest_distance(m))
+  {
+    report(m, FAIL_RECALL);
+    return;
+  }
+
+  // the recalled path's lengths, and the map's trims put back from them
+  if (!path_lengths_match(m))
+  {
+    report(m, FAIL_RECALLED_LENGTHS);
+    return;
+  }
+
+  // a fast run that misses the first two turns it can should come back
+  // to them and still finish, with the map as it was
+  sim_restart();
+  sim.segments = 0;
+  sim.overshoots = 2;
+  run_maze_aggressive();
+  sim.overshoots = 0;
+  build_path();
+
+  if (!sim_at_finish() || path_cells() != shortest_distance(m))
+  {
+    report(m, FAIL_OVERSHOOT);
+    return;
+  }
+
+  check_detours(m, edge_count);
+}
+
+void check_maze(const enum_state *s)
+{
+  sim_maze m;
+  int xmin = width, xmax = -1, ymin = height, ymax = -1;
+  int edge_count = 0;
+  int8_t dead_ends[MAX_NODES];
+  uint8_t dead_end_count = 0;
+
+  memset(&m, 0, sizeof(m));
+  m.width = width;
+  m.height = height;
+
+  for (int i = 0; i < node_count; i++)
+  {
+    int x = i % width, y = i / width;
+
+    if (s->edges & (1ULL << (2 * i)))
+      m.edges[x][y] |= SIM_NORTH_EDGE, edge_count++;
+    if (s->edges & (1ULL << (2 * i + 1)))
+      m.edges[x][y] |= SIM_EAST_EDGE, edge_count++;
+
+    // -1, 0 or 1; a straight can be no more than SIM_MAX_SIZE - 1 edges,
+    // so its trim always fits the map's -8 to 7
+    for (int e = 0; e < 2; e++)
+      m.trims[x][y][e] = (int)((s->edges * 0x9E3779B97F4A7C15ULL >> (2 * i + e)) % 3) - 1;
+
+    if (s->touched[i])
+    {
+      if (x < xmin) xmin = x;
+      if (x > xmax) xmax = x;
+      if (y < ymin) ymin = y;
+      if (y > ymax) ymax = y;
+    }
+
+    if (s->degree[i] == 1)
+      dead_ends[dead_end_count++] = i;
+  }
+
+  // translated copies don't touch every side
+  if (xmin != 0 || ymin != 0 || xmax != width - 1 || ymax != height - 1)
+    return;
+  if (dead_end_count < 2)
+    return;
+
+  __atomic_fetch_add(&results->mazes, 1, __ATOMIC_RELAXED);
+
+  for (uint8_t i = 0; i < dead_end_count; i++)
+  {
+    m.start_x = dead_ends[i] % width;
+    m.start_y = dead_ends[i] / width;
+
+    // rotated copies start facing some other way
+    if (!(m.edges[m.start_x][m.start_y] & SIM_NORTH_EDGE))
+      continue;
+
+    for (uint8_t j = 0; j < dead_end_count; j++)
+    {
+      if (j == i)
+        continue;
+      m.finish_x = dead_ends[j] % width;
+      m.finish_y = dead_ends[j] / width;
+      check_run(&m, edge_count);
+    }
+  }
+}
+
+
+// enumeration
+
+// Decides the north and east edges of node i onwards.  Nodes are closed
+// in order, so once every node of a component is closed the component
+// is final: it is the whole maze if it's the only one, and otherwise the
+// maze can't be connected.
+void enumerate(enum_state s, int i, long task)
+{
+  if (i == node_count)
+    return;
+
+  int x = i % width, y = i / width;
+  bool has_north = y < height - 1, has_east = x < width - 1;
+
+  for (uint8_t choice = 0; choice < 4; choice++)
+  {
+    if (i < prefix_nodes && choice != ((task >> (2 * i)) & 3))
+      continue;
+    if (((choice & 1) && !has_north) || ((choice & 2) && !has_east))
+      continue;
+
+    enum_state t = s;
+    if (choice & 1)
+    {
+      add_edge(&t, i, i + width);
+      t.edges |= 1ULL << (2 * i);
+    }
+    if (choice & 2)
+    {
+      add_edge(&t, i, i + 1);
+      t.edges |= 1ULL << (2 * i + 1);
+    }
+
+    if (t.loops > max_loops)
+      continue;
+
+    if (t.touched[i])
+    {
+      uint8_t root = find(&t, i);
+      if (--t.open[root] == 0)
+      {
+        // the rest of the prefix must be empty, or other tasks would
+        // check this maze again
+        bool rest_of_prefix_empty = (i + 1 >= prefix_nodes) || !(task >> (2 * (i + 1)));
+        
+        if (t.components == 1 && t.loops > 0 && rest_of_prefix_empty)
+          check_maze(&t);
+        continue;
+      }
+    }
+
+    enumerate(t, i + 1, task);
+  }
+}
+
+void worker()
+{
+  long task_count = 1L << (2 * prefix_nodes);
+  enum_state s;
+
+  memset(&s, 0, sizeof(s));
+
+  while (1)
+  {
+    long task = __atomic_fetch_add(&results->next_task, 1, __ATOMIC_RELAXED);
+    if (task >= task_count)
+      break;
+    enumerate(s, 0, task);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  int opt;
+
+  while ((opt = getopt(argc, argv, "w:h:l:j:r:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'w': width = atoi(optarg); break;
+    case 'h': height = atoi(optarg); break;
+    case 'l': max_loops = atoi(optarg); break;
+    case 'j': jobs = atoi(optarg); break;
+    case 'r': max_reports = atoi(optarg); break;
+    default:
+      fprintf(stderr, "usage: %s [-w width] [-h height] [-l max_loops] [-j jobs] [-r max_reports]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  node_count = width * height;
+  if (max_loops < 0)
+    max_loops = (width - 1) * (height - 1); // every loop a grid can hold
+  if (width < 1 || height < 1 || width > SIM_MAX_SIZE || height > SIM_MAX_SIZE || node_count > MAX_NODES)
+  {
+    fprintf(stderr, "%s: grid must fit in %d nodes of at most %d x %d\n", argv[0], MAX_NODES, SIM_MAX_SIZE, SIM_MAX_SIZE);
+    return 2;
+  }
+  if (jobs < 1)
+    jobs = 1;
+  prefix_nodes = (node_count < PREFIX_NODES) ? node_count : PREFIX_NODES;
+
+  load_params(); // the host's blank EEPROM gives the defaults
+
+  results = mmap(NULL, sizeof(shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (results == MAP_FAILED)
+  {
+    perror("mmap");
+    return 2;
+  }
+  memset(results, 0, sizeof(shared));
+
+  fflush(stdout);
+  for (int j = 0; j < jobs; j++)
+  {
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+      perror("fork");
+      return 2;
+    }
+    if (pid == 0)
+    {
+      worker();
+      _exit(0);
+    }
+  }
+
+  int status;
+  bool workers_ok = true;
+  while (wait(&status) > 0)
+  {
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      workers_ok = false;
+  }
+
+  long total_failures = 0;
+  printf("%dx%d, up to %d loops: %ld mazes, %ld runs\n", width, height, max_loops, results->mazes, results->runs);
+  for (int f = 0; f < FAIL_COUNT; f++)
+  {
+    printf("  %-32s %ld\n", fail_names[f], results->failures[f]);
+    total_failures += results->failures[f];
+  }
+  if (results->mapped)
+    printf("  %-32s %ld\n", "mean mapping ms", results->map_ms / results->mapped);
+  if (results->recalled)
+    printf("  %-32s %ld of %ld, mean %ld ms\n", "recognised on mapping again", results->recalled, results->mapped, results->recall_ms / results->recalled);
+
+  if (!workers_ok)
+  {
+    fprintf(stderr, "%s: a worker crashed\n", argv[0]);
+    return 2;
+  }
+  return total_failures ? 1 : 0;
+}
@@ -0,0 +1,272 @@
+/*
+ * mazesim - implements the 3pi library calls used by the maze solver
+ * against a virtual maze.  See mazesim.h.
+ */
+
+#include <string.h>
+#include <pololu/3pi.h>
+#include "follow-segment.h"
+#include "mazesim.h"
+
+sim_state sim;
+
+unsigned int calibrated_minimum_on[5], calibrated_maximum_on[5];
+unsigned int last_node_ms;
+bool overshot;
+uint8_t exit_power;
+volatile uint8_t PORTD, DDRD, SREG;
+
+
+void sim_load(const sim_maze *maze, unsigned int segment_limit)
+{
+  memset(&sim.traversals, 0, sizeof(sim.traversals));
+  sim.maze = maze;
+  sim.ms = 0;
+  sim.segments = 0;
+  sim.segment_limit = segment_limit;
+  sim.failure = SIM_OK;
+  sim.button_polls = 0;
+  sim.overshoots = 0;
+  sim.jitter = 0;
+  sim.jitter_seed = 1; // the same noise for the same run
+  sim_restart();
+}
+
+void sim_restart()
+{
+  sim.x = sim.maze->start_x;
+  sim.y = sim.maze->start_y;
+  dir = NORTH;
+}
+
+uint8_t sim_exits(int8_t x, int8_t y)
+{
+  const sim_maze *m = sim.maze;
+  uint8_t exits = 0;
+  
+  if (m->edges[x][y] & SIM_NORTH_EDGE)
+    exits |= 1 << NORTH;
+  if (m->edges[x][y] & SIM_EAST_EDGE)
+    exits |= 1 << EAST;
+  if (y > 0 && (m->edges[x][y - 1] & SIM_NORTH_EDGE))
+    exits |= 1 << SOUTH;
+  if (x > 0 && (m->edges[x - 1][y] & SIM_EAST_EDGE))
+    exits |= 1 << WEST;
+    
+  return exits;
+}
+
+bool sim_at_finish()
+{
+  return (sim.x == sim.maze->finish_x) && (sim.y == sim.maze->finish_y);
+}
+
+void sim_fail(uint8_t failure)
+{
+  sim.failure = failure;
+  longjmp(sim.abort, 1);
+}
+
+// Drives across one edge in the current heading.  Returns the edge's
+// trim.
+int8_t sim_step()
+{
+  if (!(sim_exits(sim.x, sim.y) & (1 << dir)))
+    sim_fail(SIM_OFF_LINE);
+  
+  switch (dir)
+  {
+  case NORTH:
+    sim.traversals[sim.x][sim.y][0]++;
+    sim.y++;
+    return sim.maze->trims[sim.x][sim.y - 1][0];
+  case EAST:
+    sim.traversals[sim.x][sim.y][1]++;
+    sim.x++;
+    return sim.maze->trims[sim.x - 1][sim.y][1];
+  case SOUTH:
+    sim.y--;
+    sim.traversals[sim.x][sim.y][0]++;
+    return sim.maze->trims[sim.x][sim.y][0];
+  default:
+    sim.x--;
+    sim.traversals[sim.x][sim.y][1]++;
+    return sim.maze->trims[sim.x][sim.y][1];
+  }
+}
+
+bool sim_at_side_exit()
+{
+  uint8_t exits = sim_exits(sim.x, sim.y);
+  return exits & ((1 << left_of(dir)) | (1 << right_of(dir)));
+}
+
+bool sim_at_stop()
+{
+  return sim_at_finish() || sim_at_side_exit() || !(sim_exits(sim.x, sim.y) & (1 << dir));
+}
+
+// follow-segment.c
+
+void follow_segment()
+{
+  long length = 0; // in 1/16 cells
+  
+  if (++sim.segments > sim.segment_limit)
+    sim_fail(SIM_NONTERMINATION);
+  
+  do
+    length += 16 + sim_step();
+  while (!sim_at_stop());
+  
+  if (sim.jitter)
+  {
+    sim.jitter_seed = sim.jitter_seed * 1103515245 + 12345;
+    length += (long)(sim.jitter_seed >> 16) % (2 * sim.jitter + 1) - sim.jitter;
+  }
+  
+  // map_maze() measures length = (ms - 65) * 16 / 709 across this call
+  // and the 250 ms of creeping that follows it
+  sim.ms += (709 * length + 8) / 16 + 65 - 250;
+}
+
+// Drives through intersections_to_ignore intersections and stops at the
+// next one, a dead end or the finish, which counts as an intersection
+// since its square reaches the outer sensors.  Returns the intersections
+// seen, and sets last_node_ms as if each cell took ms_per_cell.  Unlike
+// follow_segment(), heading into a missing line is a dead end rather
+// than a failure, since the fast runs must cope with lines removed after
+// mapping.
+uint8_t sim_follow_through(uint8_t intersections_to_ignore, unsigned int ms_per_cell)
+{
+  uint8_t intersections_seen = 0;
+  
+  if (++sim.segments > sim.segment_limit)
+    sim_fail(SIM_NONTERMINATION);
+    
+  last_node_ms = sim.ms;
+  while (sim_exits(sim.x, sim.y) & (1 << dir))
+  {
+    sim_step();
+    sim.ms += ms_per_cell;
+    
+    if (sim_at_finish() || sim_at_side_exit())
+    {
+      intersections_seen++;
+      last_node_ms = sim.ms;
+      if (sim_at_finish() || intersections_seen > intersections_to_ignore)
+        break;
+    }
+  }
+  
+  return intersections_seen;
+}
+
+uint8_t follow_segment_continuous(uint8_t intersections_to_ignore)
+{
+  return sim_follow_through(intersections_to_ignore, 709);
+}
+
+// With sim.overshoots set, misses the intersection it should stop at and
+// goes on to the next stop, arriving late, as long as the line does go
+// on; the finish square is never missed.
+uint8_t follow_segment_aggressive(uint16_t seg_length, const uint8_t *seg_lengths, uint8_t intersections_to_ignore, uint8_t top_speed)
+{
+  uint8_t intersections_seen = sim_follow_through(intersections_to_ignore, 137);
+  
+  exit_power = 128; // always braked to the crawl
+  overshot = false;
+  if (sim.overshoots && intersections_seen > intersections_to_ignore && !sim_at_finish() &&
+      (sim_exits(sim.x, sim.y) & (1 << dir)))
+  {
+    sim.overshoots--;
+    sim_follow_through(0, 137);
+    overshot = true;
+  }
+  return intersections_seen;
+}
+
+// The line is lost only where it really ends, so it is found again
+// wherever there is one ahead.
+bool find_line(int last_proportional)
+{
+  return sim_exits(sim.x, sim.y) & (1 << dir);
+}
+
+// calibrate.c; the virtual sensors need no calibrating
+
+void save_adapted_calibration() {}
+
+// line sensors
+
+unsigned int read_line(unsigned int *sensor_values, unsigned char read_mode)
+{
+  uint8_t exits = sim_exits(sim.x, sim.y);
+  bool finish = sim_at_finish();
+  
+  // a line straight ahead is under the middle sensor and partly under
+  // its neighbours; only the finish square covers all of them
+  sensor_values[0] = (finish || (exits & (1 << left_of(dir)))) ? 1000 : 0;
+  sensor_values[2] = (finish || (exits & (1 << dir))) ? 1000 : 0;
+  sensor_values[1] = sensor_values[3] = finish ? 1000 : (sensor_values[2] ? 300 : 0);
+  sensor_values[4] = (finish || (exits & (1 << right_of(dir)))) ? 1000 : 0;
+  
+  return 2000;
+}
+
+void read_line_sensors(unsigned int *sensor_values, unsigned char read_mode)
+{
+  read_line(sensor_values, read_mode);
+}
+
+void read_line_sensors_calibrated(unsigned int *sensor_values, unsigned char read_mode)
+{
+  read_line(sensor_values, read_mode);
+}
+
+void calibrate_line_sensors(unsigned char read_mode) {}
+unsigned int *get_line_sensors_calibrated_minimum_on() { return calibrated_minimum_on; }
+unsigned int *get_line_sensors_calibrated_maximum_on() { return calibrated_maximum_on; }
+void pololu_3pi_init(unsigned int line_sensor_timeout) {}
+
+// time
+
+void delay_ms(unsigned int milliseconds) { sim.ms += milliseconds; }
+void delay_us(unsigned int microseconds) {}
+unsigned long get_ms() { return sim.ms; }
+unsigned long millis() { return sim.ms; }
+unsigned long get_ticks() { return sim.ms * 2500; }
+unsigned long ticks_to_microseconds(unsigned long ticks) { return ticks * 2 / 5; }
+
+// everything else does nothing
+
+void set_motors(int left, int right) {}
+
+void clear() {}
+void print(const char *str) {}
+void print_from_program_space(const char *str) {}
+void print_long(long value) {}
+void print_unsigned_long(unsigned long value) {}
+void print_character(char c) {}
+void lcd_goto_xy(int col, int row) {}
+void lcd_load_custom_character(const char *picture, unsigned char number) {}
+
+void play(const char *sequence) {}
+void play_from_program_space(const char *sequence) {}
+void play_frequency(unsigned int freq, unsigned int duration, unsigned char volume) {}
+void stop_playing() {}
+unsigned char is_playing() { return 0; }
+
+unsigned char button_is_pressed(unsigned char buttons)
+{
+  return (sim.button_polls && --sim.button_polls == 0) ? buttons : 0;
+}
+unsigned char wait_for_button(unsigned char buttons) { return buttons & BUTTON_A; }
+unsigned char wait_for_button_press(unsigned char buttons) { return buttons & BUTTON_A; }
+unsigned char wait_for_button_release(unsigned char buttons) { return buttons & BUTTON_A; }
+unsigned char get_single_debounced_button_press(unsigned char buttons) { return 0; }
+
+int read_battery_millivolts() { return 5000; }
+
+void set_digital_output(unsigned char pin, unsigned char output_state) {}
+void set_digital_input(unsigned char pin, unsigned char input_state) {}
@@ -0,0 +1,72 @@
+/*
+ * mazesim - a virtual maze for running the maze-solving code on a host.
+ *
+ * The robot is modelled at the level of whole segments: follow_segment()
+ * moves it from one stop to the next, read_line() reports the exits of
+ * the node it is standing on, and the clock advances by the time the
+ * real robot would take.  Each edge may be a little longer or shorter
+ * than a whole cell, which mapping measures as it would on a real maze,
+ * and sim.jitter adds timing noise on top.  The robot's heading is the
+ * mapping code's own "dir", since the map and the virtual maze share the
+ * same orientation.
+ */
+
+#ifndef __mazesim_h
+#define __mazesim_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <setjmp.h>
+#include "maze-map.h"
+
+#define SIM_MAX_SIZE 8
+
+// edge bits in sim_maze.edges
+#define SIM_NORTH_EDGE 0x1
+#define SIM_EAST_EDGE  0x2
+
+typedef struct sim_maze
+{
+  uint8_t width, height;
+  uint8_t edges[SIM_MAX_SIZE][SIM_MAX_SIZE]; // x, y
+  int8_t trims[SIM_MAX_SIZE][SIM_MAX_SIZE][2]; // north, east: length off a whole cell, in 1/16 cells
+  int8_t start_x, start_y;
+  int8_t finish_x, finish_y;
+} sim_maze;
+
+// reasons for sim_fail()
+#define SIM_OK             0
+#define SIM_NONTERMINATION 1
+#define SIM_OFF_LINE       2
+
+typedef struct sim_state
+{
+  const sim_maze *maze;
+  int8_t x, y;
+  unsigned long ms;
+  unsigned int segments, segment_limit;
+  uint8_t traversals[SIM_MAX_SIZE][SIM_MAX_SIZE][2]; // north, east
+  uint8_t failure;
+  unsigned int button_polls; // button_is_pressed() calls until one is down; 0 for never
+  unsigned int overshoots; // follow_segment_aggressive() stops to drive past, where a line goes on
+  uint8_t jitter; // follow_segment() times segments up to this far out, in 1/16 cells
+  uint32_t jitter_seed;
+  jmp_buf abort;
+} sim_state;
+
+extern sim_state sim;
+
+// Places the robot on the start of the maze, facing north, and clears
+// the clock, traversal counts and jitter.  Any follow_segment() call beyond
+// segment_limit, or into a missing edge, longjmp()s to sim.abort.
+void sim_load(const sim_maze *maze, unsigned int segment_limit);
+
+// Puts the robot back on the start without clearing the counters.
+void sim_restart();
+
+// Returns the exits of a node as a bit per direction (1 << NORTH, ...).
+uint8_t sim_exits(int8_t x, int8_t y);
+
+bool sim_at_finish();
+
+#endif
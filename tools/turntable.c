@@ -0,0 +1,106 @@
+/*
+ * turntable - writes turn-table.h, the scaling turn_aggressive() applies
+ * to its turn parameters for the speed the robot comes into a turn at.
+ *
+ * The FastOut, FastIn and FTurn ms parameters are tuned for a turn from
+ * the crawl follow_segment_aggressive() brakes to, but short segments
+ * end well above it.  Scaling both wheels by s and the time by 1/s
+ * drives the same arc s times as fast, so each band of entry powers
+ * above the crawl gets the s that carries its lowest power through the
+ * turn, less whatever -k holds back for the grip lost at speed, and
+ * never more than keeps the outer wheel within full power.  Entries
+ * below the crawl use the tuned turn, since a slower turn only loses
+ * time.  Turning around always starts by stopping, so it isn't scaled.
+ *
+ * Regenerate with "make turn-table", after tuning the options against
+ * the beacon's turn timings.
+ *
+ * usage: turntable [options] > turn-table.h
+ *   -f power  the entry power the parameters are tuned at, default 128
+ *   -w power  the width of each band above it, default 32
+ *   -o power  the tuned outer wheel power, default 130 (FastOut)
+ *   -k pct    how much of the extra entry speed to carry, default 100
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#define TURN_SPEED_BANDS 4
+#define SCALE_ONE 64 // fixed point of the table
+#define MAX_POWER 255
+
+int floor_power = 128, band_width = 32, outer = 130, keep_percent = 100;
+
+int main(int argc, char **argv)
+{
+  int opt;
+
+  while ((opt = getopt(argc, argv, "f:w:o:k:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'f':
+      floor_power = atoi(optarg);
+      break;
+    case 'w':
+      band_width = atoi(optarg);
+      break;
+    case 'o':
+      outer = atoi(optarg);
+      break;
+    case 'k':
+      keep_percent = atoi(optarg);
+      break;
+    default:
+      goto usage;
+    }
+  }
+  if (optind != argc || floor_power <= 0 || floor_power > MAX_POWER || band_width <= 0 ||
+      outer <= 0 || outer > MAX_POWER || keep_percent < 0 || keep_percent > 100)
+  {
+  usage:
+    fprintf(stderr, "usage: %s [-f floor_power] [-w band_width] [-o outer_power] [-k keep_percent] > turn-table.h\n", argv[0]);
+    return 2;
+  }
+
+  printf("// Generated by tools/turntable -f %d -w %d -o %d -k %d; see there.\n\n",
+         floor_power, band_width, outer, keep_percent);
+  printf("#ifndef __turn_table_h\n#define __turn_table_h\n\n");
+  printf("#include <stdint.h>\n#include <avr/pgmspace.h>\n\n");
+  printf("#define TURN_SPEED_BANDS %d\n", TURN_SPEED_BANDS);
+  printf("#define TURN_BAND_FLOOR  %d // the entry power the parameters are tuned at\n", floor_power);
+  printf("#define TURN_BAND_WIDTH  %d\n", band_width);
+  printf("#define TURN_SCALE_ONE   %d\n\n", SCALE_ONE);
+  printf("enum { TURN_SIDE, TURN_BACK, TURN_TYPES };\n");
+  printf("enum { TURN_OUTER, TURN_INNER, TURN_MS };\n\n");
+  printf("// wheel powers and time, in 1/TURN_SCALE_ONE of the parameters\n");
+  printf("static const uint8_t turn_table[TURN_TYPES][TURN_SPEED_BANDS][3] PROGMEM = {\n");
+
+  printf("  { // left and right\n");
+  for (int band = 0; band < TURN_SPEED_BANDS; band++)
+  {
+    // the lowest entry power in the band; turn_aggressive() puts slower
+    // entries in band 0 too
+    int entry = floor_power + band * band_width;
+    double s = 1 + (double)(entry - floor_power) / floor_power * keep_percent / 100;
+    if (s * outer > MAX_POWER)
+      s = (double)MAX_POWER / outer;
+    if (s < 1)
+      s = 1;
+
+    int wheels = (int)(s * SCALE_ONE + 0.5);
+    int ms = (int)(SCALE_ONE / s + 0.5);
+    printf("    { %3d, %3d, %3d }, // from %d: x%.2f, outer wheel %d\n",
+           wheels, wheels, ms, entry, s, (int)(s * outer));
+  }
+  printf("  },\n");
+
+  printf("  { // turning around\n");
+  for (int band = 0; band < TURN_SPEED_BANDS; band++)
+    printf("    { %3d, %3d, %3d },\n", SCALE_ONE, SCALE_ONE, SCALE_ONE);
+  printf("  },\n");
+  printf("};\n\n#endif\n");
+
+  return 0;
+}
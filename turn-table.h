@@ -0,0 +1,33 @@
+// Generated by tools/turntable -f 128 -w 32 -o 130 -k 100; see there.
+
+#ifndef __turn_table_h
+#define __turn_table_h
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+#define TURN_SPEED_BANDS 4
+#define TURN_BAND_FLOOR  128 // the entry power the parameters are tuned at
+#define TURN_BAND_WIDTH  32
+#define TURN_SCALE_ONE   64
+
+enum { TURN_SIDE, TURN_BACK, TURN_TYPES };
+enum { TURN_OUTER, TURN_INNER, TURN_MS };
+
+// wheel powers and time, in 1/TURN_SCALE_ONE of the parameters
+static const uint8_t turn_table[TURN_TYPES][TURN_SPEED_BANDS][3] PROGMEM = {
+  { // left and right
+    {  64,  64,  64 }, // from 128: x1.00, outer wheel 130
+    {  80,  80,  51 }, // from 160: x1.25, outer wheel 162
+    {  96,  96,  43 }, // from 192: x1.50, outer wheel 195
+    { 112, 112,  37 }, // from 224: x1.75, outer wheel 227
+  },
+  { // turning around
+    {  64,  64,  64 },
+    {  64,  64,  64 },
+    {  64,  64,  64 },
+    {  64,  64,  64 },
+  },
+};
+
+#endif